@@ -13,13 +13,39 @@
 
 #include <linux/bitops.h>
 #include <linux/completion.h>
+#include <linux/cpumask.h>
+#include <linux/debugfs.h>
+#include <linux/delay.h>
+#include <linux/fault-inject.h>
 #include <linux/hid.h>
+#include <linux/hrtimer.h>
 #include <linux/hwmon.h>
+#include <linux/hwmon-sysfs.h>
+#include <linux/idr.h>
 #include <linux/kernel.h>
+#include <linux/kref.h>
+#include <linux/kfifo.h>
+#include <linux/kthread.h>
+#include <linux/ktime.h>
+#include <linux/list.h>
+#include <linux/math64.h>
+#include <linux/miscdevice.h>
 #include <linux/module.h>
 #include <linux/mutex.h>
+#include <linux/platform_device.h>
+#include <linux/pm_runtime.h>
+#include <linux/regmap.h>
+#include <linux/sched.h>
+#include <linux/seq_file.h>
 #include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/thermal.h>
 #include <linux/types.h>
+#include <linux/uaccess.h>
+#include <linux/usb.h>
+#include <linux/workqueue.h>
+
+#include "corsair-link.h"
 
 #define USB_VENDOR_ID_CORSAIR   0x1b1c
 
@@ -27,6 +53,8 @@
 #define IN_BUFFER_SIZE		64
 #define LABEL_LENGTH		32
 #define REQ_TIMEOUT		300
+#define WEDGED_TIMEOUTS		2 /* consecutive timeouts after which users stop waiting */
+#define MAX_BACKOFF_SHIFT	6 /* sampler backs off to at most 64 ticks */
 
 #define CMD_WRITE_REGISTER  0x02 //Writes register
 #define CMD_READ_REGISTER   0x03 //Reads register
@@ -47,102 +75,672 @@
 #define REG_DEVICE_NAME 0xFE //Read-only device name
 
 #define REG_RAIL        0xD8 //Read-write 1 - single-rail, 2 - multi-rail
+#define REG_FAN_DUTY    0x3B //Read-write fan duty in percent, used in software fan mode
+#define REG_FAN_MODE    0xF0 //Read-write 0 - hardware fan control, 1 - software
+
+enum clink_sensor {
+	CLINK_TEMP_0,
+	CLINK_TEMP_1,
+	CLINK_FAN,
+	CLINK_VOLTAGE_PS,
+	CLINK_VOLTAGE_12V,
+	CLINK_VOLTAGE_5V,
+	CLINK_VOLTAGE_3V3,
+	CLINK_CURRENT_12V,
+	CLINK_CURRENT_5V,
+	CLINK_CURRENT_3V3,
+	CLINK_POWER_PS,
+	CLINK_POWER_12V,
+	CLINK_POWER_5V,
+	CLINK_POWER_3V3,
+	CLINK_NR_SENSORS
+};
+
+enum clink_format {
+	CLINK_FMT_UNIT, /* LINEAR11 in units */
+	CLINK_FMT_MILLI, /* LINEAR11 in milli units */
+	CLINK_FMT_MICRO, /* LINEAR11 in micro units */
+};
+
+struct clink_sensor_desc {
+	u8 reg;
+	s8 rail; /* value for REG_CHANNEL_SELECT, -1 if the register does not depend on it */
+	u8 format;
+};
+
+static const struct clink_sensor_desc clink_sensors[CLINK_NR_SENSORS] = {
+	[CLINK_TEMP_0]      = { REG_TEMP_0,     -1, CLINK_FMT_MILLI },
+	[CLINK_TEMP_1]      = { REG_TEMP_1,     -1, CLINK_FMT_MILLI },
+	[CLINK_FAN]         = { REG_FAN_RPM,    -1, CLINK_FMT_UNIT },
+	[CLINK_VOLTAGE_PS]  = { REG_VOLTAGE_PS, -1, CLINK_FMT_MILLI },
+	[CLINK_VOLTAGE_12V] = { REG_VOLTAGE,     0, CLINK_FMT_MILLI },
+	[CLINK_VOLTAGE_5V]  = { REG_VOLTAGE,     1, CLINK_FMT_MILLI },
+	[CLINK_VOLTAGE_3V3] = { REG_VOLTAGE,     2, CLINK_FMT_MILLI },
+	[CLINK_CURRENT_12V] = { REG_CURRENT,     0, CLINK_FMT_MILLI },
+	[CLINK_CURRENT_5V]  = { REG_CURRENT,     1, CLINK_FMT_MILLI },
+	[CLINK_CURRENT_3V3] = { REG_CURRENT,     2, CLINK_FMT_MILLI },
+	[CLINK_POWER_PS]    = { REG_POWER_PS,   -1, CLINK_FMT_MICRO },
+	[CLINK_POWER_12V]   = { REG_POWER,       0, CLINK_FMT_MICRO },
+	[CLINK_POWER_5V]    = { REG_POWER,       1, CLINK_FMT_MICRO },
+	[CLINK_POWER_3V3]   = { REG_POWER,       2, CLINK_FMT_MICRO },
+};
+
+/* hwmon attribute names of the sensors, used to pick a sensor through debugfs */
+static const char * const clink_sensor_names[CLINK_NR_SENSORS] = {
+	[CLINK_TEMP_0]      = "temp1",
+	[CLINK_TEMP_1]      = "temp2",
+	[CLINK_FAN]         = "fan1",
+	[CLINK_VOLTAGE_PS]  = "in0",
+	[CLINK_VOLTAGE_12V] = "in1",
+	[CLINK_VOLTAGE_5V]  = "in2",
+	[CLINK_VOLTAGE_3V3] = "in3",
+	[CLINK_CURRENT_12V] = "curr1",
+	[CLINK_CURRENT_5V]  = "curr2",
+	[CLINK_CURRENT_3V3] = "curr3",
+	[CLINK_POWER_PS]    = "power1",
+	[CLINK_POWER_12V]   = "power2",
+	[CLINK_POWER_5V]    = "power3",
+	[CLINK_POWER_3V3]   = "power4",
+};
+
+#define CLINK_NR_RAILS		3
+
+/*
+ * Default sample periods in ms. Temperatures and fan speed move slowly, the USB budget is
+ * better spent on input power.
+ */
+static const u16 clink_default_sample_ms[CLINK_NR_SENSORS] = {
+	[CLINK_TEMP_0]      = 5000,
+	[CLINK_TEMP_1]      = 5000,
+	[CLINK_FAN]         = 2000,
+	[CLINK_VOLTAGE_PS]  = 2000,
+	[CLINK_VOLTAGE_12V] = 2000,
+	[CLINK_VOLTAGE_5V]  = 2000,
+	[CLINK_VOLTAGE_3V3] = 2000,
+	[CLINK_CURRENT_12V] = 1000,
+	[CLINK_CURRENT_5V]  = 1000,
+	[CLINK_CURRENT_3V3] = 1000,
+	[CLINK_POWER_PS]    = 250,
+	[CLINK_POWER_12V]   = 1000,
+	[CLINK_POWER_5V]    = 1000,
+	[CLINK_POWER_3V3]   = 1000,
+};
+
+struct clink_model {
+	const char *family;
+	const u16 *sample_ms; /* default sample period of each sensor */
+};
+
+static const struct clink_model clink_model_rmi = {
+	.family = "RMi",
+	.sample_ms = clink_default_sample_ms,
+};
+
+static const struct clink_model clink_model_hxi = {
+	.family = "HXi",
+	.sample_ms = clink_default_sample_ms,
+};
+
+/*
+ * Traffic capture format, read from debugfs and replayed by tools/clink-emu: a header followed
+ * by records, each carrying the report payload with trailing zeros stripped.
+ */
+#define CLINK_TRACE_MAGIC	"CLTR"
+#define CLINK_TRACE_VERSION	1
+#define CLINK_TRACE_OUT		0 /* output report sent to the device */
+#define CLINK_TRACE_IN		1 /* input report received from the device */
+
+struct clink_trace_header {
+	char magic[4];
+	__le16 version;
+	__le16 product; /* USB PID of the captured device */
+} __packed;
+
+struct clink_trace_record {
+	__le32 delta_us; /* time since the previous record */
+	u8 dir;
+	u8 len; /* payload bytes following the record */
+} __packed;
+
+/*
+ * Scope capture format, read from debugfs: a header followed by count records of one sensor
+ * sampled back to back.
+ */
+#define CLINK_SCOPE_MAGIC	"CLSC"
+#define CLINK_SCOPE_VERSION	1
+
+struct clink_scope_header {
+	char magic[4];
+	__le16 version;
+	u8 sensor; /* enum clink_sensor */
+	u8 reserved;
+	__le32 count; /* records following the header */
+	__le64 start_ns; /* CLOCK_MONOTONIC time of the first record */
+} __packed;
+
+struct clink_scope_record {
+	__le32 delta_us; /* time since the first record */
+	__le32 value; /* signed, in hwmon units of the sensor */
+} __packed;
+
+static unsigned int capture_size = 65536;
+module_param(capture_size, uint, 0444);
+MODULE_PARM_DESC(capture_size, "Size of the per device traffic capture buffer in bytes");
+
+static unsigned int sample_interval = 250;
+module_param(sample_interval, uint, 0444);
+MODULE_PARM_DESC(sample_interval, "Background sampler tick in ms, sensor periods are rounded up to it; 0 reads the device on every access");
+
+static unsigned int idle_timeout = 30000;
+module_param(idle_timeout, uint, 0444);
+MODULE_PARM_DESC(idle_timeout, "Stop sampling a sensor not read for this many ms, 0 samples all sensors forever");
+
+static bool serve_stale;
+module_param(serve_stale, bool, 0644);
+MODULE_PARM_DESC(serve_stale, "Return the last good value instead of waiting for the device");
+
+static unsigned int reset_threshold = 10;
+module_param(reset_threshold, uint, 0444);
+MODULE_PARM_DESC(reset_threshold, "Reset the device after this many consecutive timeouts, 0 never resets");
+
+static bool autosuspend;
+module_param(autosuspend, bool, 0444);
+MODULE_PARM_DESC(autosuspend, "Enable USB runtime autosuspend and close the device between sweeps");
+
+static unsigned int scope_samples = 16384;
+module_param(scope_samples, uint, 0444);
+MODULE_PARM_DESC(scope_samples, "Number of samples the per device scope buffer holds");
+
+static bool precise_sampling;
+module_param(precise_sampling, bool, 0444);
+MODULE_PARM_DESC(precise_sampling, "Pace sampling sweeps with hrtimers instead of jiffies");
+
+static int sampler_nice;
+module_param(sampler_nice, int, 0444);
+MODULE_PARM_DESC(sampler_nice, "Nice value of the per device sampler threads");
+
+static bool sampler_fifo;
+module_param(sampler_fifo, bool, 0444);
+MODULE_PARM_DESC(sampler_fifo, "Run the sampler threads as low priority SCHED_FIFO, overrides sampler_nice");
+
+static char *sampler_cpus;
+module_param(sampler_cpus, charp, 0444);
+MODULE_PARM_DESC(sampler_cpus, "CPU list the sampler threads may run on, e.g. 0-3 (default: any)");
+
+static unsigned int cooling_steps = 10;
+module_param(cooling_steps, uint, 0444);
+MODULE_PARM_DESC(cooling_steps, "Number of fan duty steps of the thermal cooling device, 0 registers none");
+
+static unsigned int max_inflight = 4;
+module_param(max_inflight, uint, 0444);
+MODULE_PARM_DESC(max_inflight, "Most requests kept in flight, the depth a device takes is detected at discovery; 1 sends one at a time");
+
+static bool strict_match = true;
+module_param(strict_match, bool, 0644);
+MODULE_PARM_DESC(strict_match, "Only accept responses echoing the command and register of the request");
+
+static bool aggregate = true;
+module_param(aggregate, bool, 0444);
+MODULE_PARM_DESC(aggregate, "Register corsairlink_total summing all devices");
+
+#define CLINK_FAN_POINTS	5
+
+/* values of pwm1_enable */
+enum clink_pwm_enable {
+	CLINK_PWM_FULL, /* software mode at full duty */
+	CLINK_PWM_MANUAL, /* software mode at the duty written to pwm1 */
+	CLINK_PWM_FIRMWARE, /* the PSU controls its fan */
+	CLINK_PWM_CURVE, /* software mode, duty set by the sampler from the point table */
+};
+
+struct clink_fan_point {
+	long temp; /* millidegree Celsius */
+	u8 pwm;
+};
+
+static const struct clink_fan_point clink_default_curve[CLINK_FAN_POINTS] = {
+	{ 30000, 102 }, { 40000, 128 }, { 50000, 166 }, { 60000, 217 }, { 70000, 255 },
+};
+
+struct clink_fan {
+	int enable; /* enum clink_pwm_enable */
+	u8 pwm; /* duty for manual mode, last duty set by the curve otherwise */
+	struct clink_fan_point points[CLINK_FAN_POINTS];
+	u32 channels; /* temperatures the curve follows, bit 0 temp1, bit 1 temp2 */
+	long hyst; /* millidegree the temperature has to fall before the duty is lowered */
+	long curve_temp; /* temperature the curve was last evaluated at */
+	unsigned long cooling; /* state of the cooling device, 0 leaves the duty to pwm1_enable */
+};
+
+struct clink_sample {
+	long value;
+	ktime_t time; /* when value was read */
+	bool valid; /* a good value has been read */
+	bool failed; /* the last read failed, value is older than the last try */
+};
+
+#define CLINK_MAX_INFLIGHT	8
+#define CLINK_RAIL_SENSORS	5 /* most sensors read in one rail group, the rail independent ones */
+
+/*
+ * Slots are taken under mutex by everything but the sampler, which takes a rail's worth outside
+ * it. Depth detection needs the most at once, two full windows.
+ */
+#define CLINK_NR_SLOTS		(2 * CLINK_MAX_INFLIGHT + CLINK_RAIL_SENSORS)
+
+#define CLINK_TRANSPORT_ROUNDS	8 /* round trips timed per transport */
+
+/* ways of sending an output report, the fastest one is picked per device */
+enum clink_transport {
+	CLINK_TRANSPORT_OUTPUT, /* hid_hw_output_report, interrupt OUT endpoint if there is one */
+	CLINK_TRANSPORT_RAW, /* hid_hw_raw_request, SET_REPORT on the control pipe */
+	CLINK_NR_TRANSPORTS
+};
+
+static const char * const clink_transport_names[] = {
+	[CLINK_TRANSPORT_OUTPUT] = "output",
+	[CLINK_TRANSPORT_RAW] = "raw",
+};
+
+/* a request and its response, preallocated with DMA safe buffers */
+struct clink_slot {
+	u8 *report; /* report id 0 followed by out, for CLINK_TRANSPORT_RAW */
+	u8 *out; /* command, register and arguments */
+	u8 *in; /* response */
+	int out_len;
+	u8 cmd, reg; /* echoed by the response */
+	int result; /* 0, -EINPROGRESS while in flight or a negative errno */
+	ktime_t rx_time; /* arrival of the response */
+	int sensor; /* sensor the response is decoded into by raw_event, -1 to copy it to in */
+};
+
+struct clink_stats {
+	u64 transactions; /* output reports sent */
+	u64 timeouts; /* requests left without response within REQ_TIMEOUT */
+	u64 errors; /* output reports the transport failed to send */
+	u64 capture_dropped; /* reports not captured for lack of space, protected by trace_lock */
+	u64 link_closes; /* times the device was closed to let it autosuspend */
+	u64 resumes; /* opens that had to resume the device */
+	u64 recoveries; /* resets and rediscoveries after the device stopped answering */
+	u64 batches; /* batches run for userspace through the character device */
+	u64 mismatches; /* reports not answering the pending request, protected by lock */
+};
+
+/* sweep pacing of the sampler thread, lateness is how late a sweep started */
+struct clink_jitter {
+	u64 sweeps;
+	u64 overruns; /* sweep slots missed because the previous sweep ran too long */
+	u64 lateness_sum; /* ns */
+	u64 lateness_sq_sum; /* us^2, ns^2 overflows once lateness reaches seconds */
+	u64 lateness_max; /* ns */
+	u64 last_sweep; /* duration of the last sweep in ns */
+};
+
+enum clink_scope_state {
+	CLINK_SCOPE_IDLE,
+	CLINK_SCOPE_ARMED, /* waiting for the sensor to reach threshold */
+	CLINK_SCOPE_RUNNING,
+	CLINK_SCOPE_DONE,
+};
+
+/*
+ * Burst capture run by the sampler thread. The configuration and buffer are only changed
+ * while the scope is idle or done; the sampler owns the buffer while the scope is running.
+ */
+struct clink_scope {
+	struct mutex lock; /* keeps the capture from being started while buf is read out */
+	int state; /* enum clink_scope_state, protected by sample_lock */
+	bool stop; /* asks the sampler to end the capture, protected by sample_lock */
+	int sensor;
+	u32 duration_ms;
+	long threshold;
+	struct clink_scope_record *buf; /* scope_samples records, allocated on first use */
+	u32 count;
+	ktime_t start;
+};
+
+enum clink_state_bits {
+	CLINK_STATE_SUSPENDED, /* system suspend, no transactions allowed */
+	CLINK_STATE_RESUMED, /* device state has to be checked after resume */
+	CLINK_STATE_STALE, /* snapshot predates a suspend, no fresh sweep done yet */
+	CLINK_STATE_NAMED, /* name has been read from the device */
+	CLINK_STATE_DISCOVER, /* discovery was cancelled by a suspend and is due on resume */
+};
+
+#ifdef CONFIG_FAULT_INJECTION
+#define CLINK_FAIL_DELAYED	(2 * CLINK_MAX_INFLIGHT) /* delayed responses held at once */
+
+/* a response held back by fail_delay until due */
+struct clink_delayed_report {
+	unsigned long due; /* jiffies */
+	u8 data[IN_BUFFER_SIZE];
+};
+#endif
 
 struct clink_device {
 	struct hid_device *hdev;
+	unsigned long state; /* enum clink_state_bits */
+	const struct clink_model *model;
 	struct device *hwmon_dev;
-	struct completion wait_input_report;
-	struct mutex mutex; /* whenever buffer is used, lock before send_usb_cmd */
-	u8 *buffer;
-    char name[64];
-    int command_index;
+	struct dentry *debugfs;
+	struct list_head node; /* in clink_list */
+	struct mutex mutex; /* serialises transfers, lock before clink_send_cmd */
+	struct regmap *regmap; /* all registers but REG_DEVICE_NAME, used under mutex */
+	spinlock_t lock; /* protects the slot pool and the window */
+	struct clink_slot slots[CLINK_NR_SLOTS];
+	unsigned long free_slots; /* bitmap of slots not in use */
+	struct usb_device *udev; /* set if the driver lets the device autosuspend */
+	bool autosuspend_was_on; /* autosuspend was enabled before probe */
+	bool opened; /* hid_hw_open() is in effect, protected by mutex */
+	u64 resume_ns; /* average time the device takes to resume, protected by mutex */
+    char name[64]; /* valid once CLINK_STATE_NAMED is set, protected by mutex */
+	struct work_struct discover_work;
+	int rail; /* selected through REG_CHANNEL_SELECT, -1 if unknown; protected by mutex */
+	struct clink_fan fan; /* protected by mutex */
+	struct thermal_cooling_device *cdev; /* NULL if not registered */
+	struct clink_chardev *chardev; /* NULL if not registered */
+	struct clink_stats stats; /* protected by mutex */
+	unsigned int timeouts_in_row; /* consecutive timeouts, protected by mutex */
+	unsigned int recoveries_in_row; /* recoveries since the last answer, protected by mutex */
+	unsigned int recover_at; /* timeouts_in_row of the next recovery, protected by mutex */
+	spinlock_t sample_lock; /* protects samples and energy, taken in raw_event inside lock */
+	struct clink_sample samples[CLINK_NR_SENSORS];
+	u32 sample_ms[CLINK_NR_SENSORS]; /* sample period of each sensor */
+	u64 next_tick[CLINK_NR_SENSORS]; /* sampler tick the sensor is due at, sampler only */
+	ktime_t last_access[CLINK_NR_SENSORS]; /* last read of the sensor by a user, 0 if never */
+	u64 energy; /* input energy in microjoule integrated from CLINK_POWER_PS */
+	struct task_struct *sampler; /* NULL if sample_interval is 0 */
+	struct clink_jitter jitter; /* protected by sample_lock */
+	struct clink_scope scope;
+	ktime_t rx_time; /* arrival of the last response read through regmap, protected by mutex */
+	struct clink_slot *window[CLINK_MAX_INFLIGHT]; /* requests sent, protected by lock */
+	unsigned int nr_inflight; /* protected by lock */
+	unsigned int transfer_pending; /* requests of the batch not yet answered, protected by lock */
+	struct completion transfer_done; /* completed by raw_event when transfer_pending drops to 0 */
+	unsigned int depth; /* requests the device takes in flight, 0 until detected; protected by mutex */
+	enum clink_transport transport; /* protected by mutex */
+	s64 transport_ns[CLINK_NR_TRANSPORTS]; /* mean round trip, 0 if not timed or errno; mutex */
+	bool capture;
+	spinlock_t trace_lock; /* protects trace and trace_last */
+	DECLARE_KFIFO_PTR(trace, u8);
+	ktime_t trace_last;
+#ifdef CONFIG_FAULT_INJECTION
+	struct fault_attr fail_drop; /* response is lost */
+	struct fault_attr fail_delay; /* response arrives fail_delay_ms late */
+	struct fault_attr fail_corrupt; /* value of the response is corrupted, the echo kept */
+	struct fault_attr fail_stale; /* previous response is delivered again */
+	u32 fail_delay_ms;
+	struct delayed_work fail_delay_work;
+	struct clink_delayed_report delayed[CLINK_FAIL_DELAYED]; /* ring, protected by lock */
+	unsigned int delayed_head, delayed_count; /* protected by lock */
+	u8 last_report[IN_BUFFER_SIZE]; /* protected by lock */
+#endif
 };
 
+static struct dentry *clink_debugfs_root;
+
+static LIST_HEAD(clink_list);
+static DEFINE_MUTEX(clink_list_lock); /* protects clink_list and clink_energy_retired */
+static u64 clink_energy_retired; /* energy of devices gone since module load */
+static struct platform_device *clink_total_pdev;
+static struct device *clink_total_hwmon;
+
 static const char power_labels[4][LABEL_LENGTH] = { "PSU input power", "+12V power", "+5V power", "+3.3V power"};
 static const char voltage_labels[4][LABEL_LENGTH] = { "PSU input voltage", "+12V voltage", "+5V voltage", "+3.3V voltage"};
 static const char current_labels[3][LABEL_LENGTH] = { "+12V current", "+5V current", "+3.3V current"};
+static const char energy_labels[1][LABEL_LENGTH] = { "PSU input energy" };
 
-/* converts response error in buffer to errno */
-static int clink_get_errno(struct clink_device *clink)
+/* appends a report to the capture buffer if capturing is enabled */
+static void clink_trace(struct clink_device *clink, u8 dir, const u8 *data, int len)
 {
-	switch (clink->buffer[0]) {
-	case 0x00: /* success */
-		return 0;
-	case 0x01: /* called invalid command */
-		return -EOPNOTSUPP;
-	case 0x10: /* called GET_VOLT / GET_TMP with invalid arguments */
-		return -EINVAL;
-	case 0x11: /* requested temps of disconnected sensors */
-	case 0x12: /* requested pwm of not pwm controlled channels */
-		return -ENODATA;
-	default:
-		hid_dbg(clink->hdev, "unknown device response error: %d", clink->buffer[0]);
-		return -EIO;
+	struct clink_trace_record rec;
+	unsigned long flags;
+	ktime_t now;
+
+	if (!READ_ONCE(clink->capture))
+		return;
+
+	while (len > 0 && !data[len - 1])
+		len--;
+
+	spin_lock_irqsave(&clink->trace_lock, flags);
+
+	now = ktime_get();
+	if (kfifo_avail(&clink->trace) >= sizeof(rec) + len) {
+		rec.delta_us = cpu_to_le32(min_t(s64, ktime_us_delta(now, clink->trace_last), U32_MAX));
+		rec.dir = dir;
+		rec.len = len;
+		kfifo_in(&clink->trace, (u8 *)&rec, sizeof(rec));
+		kfifo_in(&clink->trace, data, len);
+		clink->trace_last = now;
+	} else {
+		clink->stats.capture_dropped++;
 	}
+
+	spin_unlock_irqrestore(&clink->trace_lock, flags);
 }
 
-static int clink_raw_event(struct hid_device *hdev, struct hid_report *report, u8 *data, int size)
+/* takes a slot from the pool, NULL if all are in use */
+static struct clink_slot *clink_get_slot(struct clink_device *clink)
 {
-	struct clink_device *clink = hid_get_drvdata(hdev);
+	struct clink_slot *slot = NULL;
+	unsigned int i;
+
+	spin_lock_irq(&clink->lock);
+	i = find_first_bit(&clink->free_slots, CLINK_NR_SLOTS);
+	if (i < CLINK_NR_SLOTS) {
+		__clear_bit(i, &clink->free_slots);
+		slot = &clink->slots[i];
+	}
+	spin_unlock_irq(&clink->lock);
 
-	/* only copy buffer when requested */
-	if (completion_done(&clink->wait_input_report))
-		return 0;
+	if (slot) {
+		slot->out_len = 0;
+		slot->result = 0;
+		slot->rx_time = 0;
+		slot->sensor = -1;
+	}
+
+	return slot;
+}
 
-	memcpy(clink->buffer, data, min(IN_BUFFER_SIZE, size));
-	complete(&clink->wait_input_report);
+static void clink_put_slot(struct clink_device *clink, struct clink_slot *slot)
+{
+	spin_lock_irq(&clink->lock);
+	__set_bit(slot - clink->slots, &clink->free_slots);
+	spin_unlock_irq(&clink->lock);
+}
 
-	return 0;
+static void clink_put_slots(struct clink_device *clink, struct clink_slot **slots, int n)
+{
+	while (n--)
+		clink_put_slot(clink, slots[n]);
 }
 
-static int clink_record_cmd(struct clink_device* clink, u8 cmd, u8 arg0)
+static void clink_record_cmd(struct clink_slot* slot, u8 cmd, u8 arg0)
 {
-    clink->buffer[clink->command_index++] = cmd;
-    clink->buffer[clink->command_index++] = arg0;
+    slot->out[slot->out_len++] = cmd;
+    slot->out[slot->out_len++] = arg0;
 }
 
-static int clink_record_cmd2(struct clink_device* clink, u8 cmd, u8 arg0, u8 arg1)
+static void clink_record_cmd2(struct clink_slot* slot, u8 cmd, u8 arg0, u8 arg1)
 {
-    clink_record_cmd(clink, cmd, arg0);
-    clink->buffer[clink->command_index++] = arg1;
+    clink_record_cmd(slot, cmd, arg0);
+    slot->out[slot->out_len++] = arg1;
 }
 
-static int clink_send_cmd(struct clink_device* clink)
+/* opens the device, resuming it if it autosuspended; mutex must be held */
+static int clink_hw_open(struct clink_device *clink)
 {
-    int ret = 0;
+	bool suspended;
+	ktime_t start;
+	int ret;
 
-    reinit_completion(&clink->wait_input_report);
+	if (clink->opened)
+		return 0;
 
-    ret = hid_hw_output_report(clink->hdev, clink->buffer, OUT_BUFFER_SIZE);
-    if (ret < 0)
-        return ret;
+	suspended = clink->udev && pm_runtime_suspended(&clink->udev->dev);
+	start = ktime_get();
 
-    ret = wait_for_completion_timeout(&clink->wait_input_report, msecs_to_jiffies(REQ_TIMEOUT));
-    if (!ret)
-        return -ETIMEDOUT;
+	ret = hid_hw_open(clink->hdev);
+	if (ret)
+		return ret;
 
-    //Reset command index
-    clink->command_index = 0;
+	/* moving average over the opens that actually resumed the device */
+	if (suspended) {
+		clink->resume_ns = (clink->resume_ns * 7 + ktime_to_ns(ktime_sub(ktime_get(), start))) / 8;
+		clink->stats.resumes++;
+	}
+	clink->opened = true;
 
-    return ret;
+	return 0;
 }
 
-static int clink_temperature(
-    struct clink_device* clink,
-    uint8_t probe)
+/* closes the device so it can autosuspend; mutex must be held */
+static void clink_hw_close(struct clink_device *clink)
 {
-    int ret;
-    uint16_t temp;
+	if (!clink->opened)
+		return;
+
+	hid_hw_close(clink->hdev);
+	clink->opened = false;
+	clink->stats.link_closes++;
+}
+
+static int clink_hw_send(struct clink_device *clink, struct clink_slot *slot,
+			 enum clink_transport transport)
+{
+	if (transport == CLINK_TRANSPORT_RAW)
+		return hid_hw_raw_request(clink->hdev, 0, slot->report, OUT_BUFFER_SIZE + 1,
+					  HID_OUTPUT_REPORT, HID_REQ_SET_REPORT);
+
+	return hid_hw_output_report(clink->hdev, slot->out, OUT_BUFFER_SIZE);
+}
+
+/* sends the request in slot, registering it in the window first; mutex must be held */
+static int clink_send_request(struct clink_device *clink, struct clink_slot *slot)
+{
+	enum clink_transport transport;
+	int ret;
+
+	memset(slot->out + slot->out_len, 0, OUT_BUFFER_SIZE - slot->out_len);
+
+	slot->cmd = slot->out[0];
+	slot->reg = slot->out[1];
+	slot->result = -EINPROGRESS;
+
+	spin_lock_irq(&clink->lock);
+	clink->window[clink->nr_inflight++] = slot;
+	spin_unlock_irq(&clink->lock);
+
+	clink->stats.transactions++;
+
+	clink_trace(clink, CLINK_TRACE_OUT, slot->out, slot->out_len);
+
+	ret = clink_hw_send(clink, slot, clink->transport);
+	/*
+	 * A failing SET_REPORT falls back to output reports, a transport driver without output
+	 * reports (-ENOSYS) to SET_REPORT. The switch sticks once the other path works.
+	 */
+	if ((ret < 0 && clink->transport == CLINK_TRANSPORT_RAW) || ret == -ENOSYS) {
+		transport = clink->transport == CLINK_TRANSPORT_RAW ? CLINK_TRANSPORT_OUTPUT :
+								      CLINK_TRANSPORT_RAW;
+		if (clink_hw_send(clink, slot, transport) >= 0) {
+			hid_warn(clink->hdev, "%s failed: %d, sending through %s\n",
+				 clink_transport_names[clink->transport], ret,
+				 clink_transport_names[transport]);
+			clink->transport = transport;
+			ret = 0;
+		}
+	}
+	if (ret < 0) {
+		clink->stats.errors++;
+		spin_lock_irq(&clink->lock);
+		clink->nr_inflight--;
+		spin_unlock_irq(&clink->lock);
+		slot->result = ret;
+		return ret;
+	}
+
+	return 0;
+}
+
+/*
+ * Runs n requests in batches of up to depth in flight, so the round trips of a sweep overlap
+ * instead of adding up. Returns 0 or the first error, every slot carries its own result;
+ * mutex must be held.
+ */
+static int clink_transfer(struct clink_device *clink, struct clink_slot **slots, int n)
+{
+	int depth = clamp_t(int, clink->depth, 1, CLINK_MAX_INFLIGHT);
+	int sent = 0, done = 0, batch, i, ret;
+
+	/* fail fast rather than time out while the device is suspended */
+	if (test_bit(CLINK_STATE_SUSPENDED, &clink->state)) {
+		ret = -EAGAIN;
+		goto out_unsent;
+	}
 
-    clink_record_cmd(clink, CMD_READ_REGISTER, REG_TEMP_0 + probe);
+	ret = clink_hw_open(clink);
+	if (ret)
+		goto out_unsent;
+
+	while (done < n) {
+		batch = min(n - done, depth);
+		reinit_completion(&clink->transfer_done);
+		spin_lock_irq(&clink->lock);
+		clink->transfer_pending = batch;
+		spin_unlock_irq(&clink->lock);
+
+		while (sent < done + batch) {
+			ret = clink_send_request(clink, slots[sent]);
+			if (ret)
+				goto out_cancel;
+			sent++;
+		}
+
+		/*
+		 * raw_event completes the transfer once every request of the batch is answered, in
+		 * whatever order, so the waiter wakes once per batch rather than once per request.
+		 */
+		if (!wait_for_completion_timeout(&clink->transfer_done, msecs_to_jiffies(REQ_TIMEOUT)))
+			goto out_timeout;
+		done = sent;
+
+		WRITE_ONCE(clink->timeouts_in_row, 0);
+		WRITE_ONCE(clink->recoveries_in_row, 0);
+	}
+
+	return 0;
+
+out_timeout:
+	clink->stats.timeouts++;
+	WRITE_ONCE(clink->timeouts_in_row, clink->timeouts_in_row + 1);
+	ret = -ETIMEDOUT;
+out_cancel:
+	/* responses still on their way are counted as mismatches */
+	spin_lock_irq(&clink->lock);
+	clink->nr_inflight = 0;
+	clink->transfer_pending = 0;
+	spin_unlock_irq(&clink->lock);
+
+	for (i = 0; i < n; i++)
+		if (slots[i]->result == -EINPROGRESS || i >= sent)
+			slots[i]->result = ret;
 
-    ret = clink_send_cmd(clink);
-    if (ret < 0)
-        return ret;
+	return ret;
+
+out_unsent:
+	for (i = 0; i < n; i++)
+		slots[i]->result = ret;
 
-    temp = ( clink->buffer[2] << 8 ) + clink->buffer[3];
+	return ret;
+}
 
-    return temp;
+/* sends the command recorded in slot and waits for its response */
+static int clink_send_cmd(struct clink_device* clink, struct clink_slot *slot)
+{
+    return clink_transfer(clink, &slot, 1);
 }
 
 int pow2i(int exp)
@@ -179,292 +777,2589 @@ int get_int_from_uint16_double(uint16_t data)
 	
 }
 
-static int clink_voltage(
-    struct clink_device* clink,
-    uint8_t probe)
+static int corsairlink_clink_name(
+    struct clink_device* clink)
 {
+    struct clink_slot *slot;
     int ret;
-    uint16_t read_value;
-
-    u8 reg = REG_VOLTAGE_PS;
 
-    if (probe != 0)
-    {
-        clink_record_cmd2(clink, CMD_WRITE_REGISTER, REG_CHANNEL_SELECT, probe - 1);
-        ret = clink_send_cmd(clink);
-        if (ret < 0)
-            return ret;
+    slot = clink_get_slot(clink);
+    if (!slot)
+        return -EBUSY;
 
-        reg = REG_VOLTAGE;
+    clink_record_cmd(slot, CMD_READ_REGISTER, REG_DEVICE_NAME);
+    ret = clink_send_cmd(clink, slot);
+    if (!ret) {
+        /* the name fills the report after command and register */
+        memset(clink->name, 0, sizeof(clink->name));
+        memcpy(clink->name, slot->in + 2, min_t(size_t, sizeof(clink->name), IN_BUFFER_SIZE - 2));
     }
 
-    clink_record_cmd(clink, CMD_READ_REGISTER, reg);
+    clink_put_slot(clink, slot);
 
-    ret = clink_send_cmd(clink);
+    return ret;
+}
+
+/*
+ * Reads the device name, when it is known already checks the device is still the one probed
+ * after a resume that may have been a replug.
+ */
+static void clink_verify_name(struct clink_device *clink)
+{
+	char old[sizeof(clink->name)];
+	int ret;
 
-    read_value = ( clink->buffer[3] << 8 ) | clink->buffer[2];
+	mutex_lock(&clink->mutex);
+	memcpy(old, clink->name, sizeof(old));
+	ret = corsairlink_clink_name(clink);
+	mutex_unlock(&clink->mutex);
 
-	return get_int_from_uint16_double(read_value);
+	if (ret)
+		hid_warn(clink->hdev, "cannot read device name: %d\n", ret);
+	else if (test_and_set_bit(CLINK_STATE_NAMED, &clink->state) &&
+		 memcmp(old, clink->name, sizeof(old)))
+		hid_warn(clink->hdev, "device changed from %.*s to %.*s across suspend\n",
+			 (int)sizeof(old), old, (int)sizeof(clink->name), clink->name);
 }
 
-static int clink_power(
-    struct clink_device* clink,
-    uint8_t probe)
+/*
+ * Registers behind CMD_READ_REGISTER/CMD_WRITE_REGISTER. Sensors are volatile; the rail window
+ * registers read whatever REG_CHANNEL_SELECT points at, so like the other volatile registers
+ * they are precious. REG_DEVICE_NAME is a string and stays outside the map. With the map's
+ * locking disabled regmap has no debugfs of its own, the driver's "registers" file shows the
+ * cached configuration instead.
+ */
+static bool clink_reg_writeable(struct device *dev, unsigned int reg)
 {
-    int ret;
-    uint16_t read_value;
-
-    u8 reg = REG_POWER_PS;
+	switch (reg) {
+	case REG_CHANNEL_SELECT:
+	case REG_RAIL:
+	case REG_FAN_DUTY:
+	case REG_FAN_MODE:
+		return true;
+	default:
+		return false;
+	}
+}
 
-    if (probe != 0)
-    {
-        clink_record_cmd2(clink, CMD_WRITE_REGISTER, REG_CHANNEL_SELECT, probe - 1);
-        ret = clink_send_cmd(clink);
-        if (ret < 0)
-            return ret;
+static bool clink_reg_readable(struct device *dev, unsigned int reg)
+{
+	switch (reg) {
+	case REG_TEMP_0:
+	case REG_TEMP_1:
+	case REG_VOLTAGE_PS:
+	case REG_VOLTAGE:
+	case REG_CURRENT:
+	case REG_FAN_RPM:
+	case REG_POWER:
+	case REG_POWER_PS:
+		return true;
+	default:
+		return clink_reg_writeable(dev, reg);
+	}
+}
 
-        reg = REG_POWER;
-    }
+/* configuration the device keeps until it loses power, cached and restored after resets */
+static const unsigned int clink_cached_regs[] = { REG_RAIL, REG_FAN_MODE, REG_FAN_DUTY };
 
-    clink_record_cmd(clink, CMD_READ_REGISTER, reg);
+static bool clink_reg_volatile(struct device *dev, unsigned int reg)
+{
+	int i;
 
-    ret = clink_send_cmd(clink);
-    if (ret < 0)
-        return ret;
+	for (i = 0; i < ARRAY_SIZE(clink_cached_regs); i++)
+		if (clink_cached_regs[i] == reg)
+			return false;
 
-    read_value = ( clink->buffer[3] << 8 ) | clink->buffer[2];
+	return true;
+}
 
-    return get_int_from_uint16_double(read_value) * 1000;
+static bool clink_reg_precious(struct device *dev, unsigned int reg)
+{
+	return clink_reg_volatile(dev, reg);
 }
 
-static int clink_current(
-	struct clink_device* clink,
-	uint8_t probe)
+static int clink_regmap_read(void *context, unsigned int reg, unsigned int *val)
 {
+	struct clink_device *clink = context;
+	struct clink_slot *slot;
 	int ret;
-    uint16_t read_value;
-	
-    clink_record_cmd2(clink, CMD_WRITE_REGISTER, REG_CHANNEL_SELECT, probe);
-    ret = clink_send_cmd(clink);
-    if (ret < 0)
-        return ret;
 
-    clink_record_cmd(clink, CMD_READ_REGISTER, REG_CURRENT);
-    ret = clink_send_cmd(clink);
-	if (ret < 0)
-		return ret;
-	
-    read_value = ( clink->buffer[3] << 8 ) | clink->buffer[2];
-	
-    return get_int_from_uint16_double(read_value);
+	slot = clink_get_slot(clink);
+	if (!slot)
+		return -EBUSY;
+
+	clink_record_cmd(slot, CMD_READ_REGISTER, reg);
+	ret = clink_send_cmd(clink, slot);
+	if (!ret) {
+		/* sensors are little endian words, the writeable registers one byte */
+		*val = (slot->in[3] << 8) | slot->in[2];
+		if (clink_reg_writeable(NULL, reg))
+			*val &= 0xff;
+		clink->rx_time = slot->rx_time;
+	}
+
+	clink_put_slot(clink, slot);
+
+	return ret;
 }
 
-static int clink_fan(
-	struct clink_device* clink)
+static int clink_regmap_write(void *context, unsigned int reg, unsigned int val)
 {
+	struct clink_device *clink = context;
+	struct clink_slot *slot;
 	int ret;
-    uint16_t read_value;
-	
-    clink_record_cmd(clink, CMD_READ_REGISTER, REG_FAN_RPM);
-	ret = clink_send_cmd(clink);
-	if (ret < 0)
-		return ret;
-	
-	read_value = ( clink->buffer[3] << 8 ) | clink->buffer[2];
-	
-	return read_value;
+
+	slot = clink_get_slot(clink);
+	if (!slot)
+		return -EBUSY;
+
+	clink_record_cmd2(slot, CMD_WRITE_REGISTER, reg, val);
+	ret = clink_send_cmd(clink, slot);
+
+	clink_put_slot(clink, slot);
+
+	return ret;
 }
 
-static int clink_read_string(struct device *dev, enum hwmon_sensor_types type,
-			   u32 attr, int channel, const char **str)
+static const struct regmap_bus clink_regmap_bus = {
+	.reg_read = clink_regmap_read,
+	.reg_write = clink_regmap_write,
+};
+
+static const struct regmap_config clink_regmap_config = {
+	.name = "clink",
+	.reg_bits = 8,
+	.val_bits = 16,
+	.max_register = 0xff,
+	.writeable_reg = clink_reg_writeable,
+	.readable_reg = clink_reg_readable,
+	.volatile_reg = clink_reg_volatile,
+	.precious_reg = clink_reg_precious,
+	.cache_type = REGCACHE_RBTREE,
+	/* reads of the rail window depend on REG_CHANNEL_SELECT, so both go under mutex anyway */
+	.disable_locking = true,
+};
+
+/* writes back what a reset or power cut of the device lost and fills the register cache */
+static void clink_restore(struct clink_device *clink)
 {
-	switch (type) {
-		case hwmon_in:
-			switch (attr) {
-			case hwmon_in_label:
-				*str = voltage_labels[channel];
-				return 0;
-			default:
-				break;
-			}
-			break;
-		
-		case hwmon_power:
-			switch (attr) {
-			case hwmon_power_label:
-				*str = power_labels[channel];
-				return 0;
-			default:
-				break;
-			}
-			break;
-			
-		case hwmon_curr:
-			switch (attr) {
-				case hwmon_curr_label:
-					*str = current_labels[channel];
-					return 0;
-				default:
-					break;
-			}
-			break;
-				
+	unsigned int val;
+	int i, ret;
 
-		default:
-			break;
-	}
+	mutex_lock(&clink->mutex);
+	ret = regcache_sync(clink->regmap);
+	for (i = 0; i < ARRAY_SIZE(clink_cached_regs) && !ret; i++)
+		ret = regmap_read(clink->regmap, clink_cached_regs[i], &val);
+	mutex_unlock(&clink->mutex);
 
-	return -EOPNOTSUPP;
+	if (ret)
+		hid_warn(clink->hdev, "cannot restore configuration: %d\n", ret);
 }
 
-static int clink_read(struct device *dev, enum hwmon_sensor_types type,
-		    u32 attr, int channel, long *val)
-{
-	struct clink_device *clink = dev_get_drvdata(dev);
-	int ret;
+static const u8 clink_depth_probe[][2] = {
+	{ CMD_READ_REGISTER, REG_TEMP_0 },
+	{ CMD_READ_REGISTER, REG_TEMP_1 },
+	{ CMD_READ_REGISTER, REG_FAN_RPM },
+	{ CMD_READ_REGISTER, REG_VOLTAGE_PS },
+	{ CMD_READ_REGISTER, REG_POWER_PS },
+};
 
-	switch (type) {
-	case hwmon_temp:
-		switch (attr) {
-		case hwmon_temp_input:
-            ret = clink_temperature(clink, channel);
-			if (ret < 0)
-				return ret;
-			*val = ret;
-			return 0;
-		default:
-			break;
-		}
-		break;
-	case hwmon_fan:
-		switch (attr) {
-		case hwmon_fan_input:
-			ret = clink_fan(clink);
-			if (ret < 0)
-				return ret;
-			*val = ret;
-			return 0;
-		default:
-			break;
+/*
+ * Finds how many requests the device takes in flight: a depth is kept once two full windows of
+ * requests at it are all answered, otherwise it is halved down to one request at a time.
+ */
+static void clink_detect_depth(struct clink_device *clink)
+{
+	unsigned int depth = clamp(max_inflight, 1U, (unsigned int)CLINK_MAX_INFLIGHT);
+	struct clink_slot *slots[CLINK_NR_SLOTS];
+	const u8 *out;
+	int i, n, ret;
+
+	mutex_lock(&clink->mutex);
+	for (n = 0; n < 2 * depth; n++) {
+		slots[n] = clink_get_slot(clink);
+		if (!slots[n]) {
+			clink_put_slots(clink, slots, n);
+			mutex_unlock(&clink->mutex);
+			hid_warn(clink->hdev, "no request slots to detect the pipeline depth\n");
+			return;
 		}
-		break;
-	case hwmon_curr:
-		switch (attr) {
-		case hwmon_curr_input:
-			ret = clink_current(clink, channel);
-			if (ret < 0)
-				return ret;
-			*val = ret;
-			return 0;
-		default:
-			break;
+	}
+
+	for (; depth > 1; depth /= 2) {
+		for (i = 0; i < 2 * depth; i++) {
+			out = clink_depth_probe[i % ARRAY_SIZE(clink_depth_probe)];
+			slots[i]->out_len = 0;
+			clink_record_cmd(slots[i], out[0], out[1]);
 		}
-		break;
-	case hwmon_power:
-		switch (attr) {
-		case hwmon_power_input:
-			ret = clink_power(clink, channel);
-			if (ret < 0)
-				return ret;
-			*val = ret;
-			return 0;
-		default:
+
+		clink->depth = depth;
+		ret = clink_transfer(clink, slots, 2 * depth);
+		if (!ret)
 			break;
-		}
-		break;
-	case hwmon_in:
-		switch (attr) {
-		case hwmon_in_input:
-            ret = clink_voltage(clink, channel);
-			if (ret < 0)
-				return ret;
-			*val = ret;
-			return 0;
-		default:
+		if (ret != -ETIMEDOUT) {
+			depth = 1;
 			break;
 		}
-		break;
-	default:
-		break;
+
+		/* lets responses still queued in the device drain before the next try */
+		msleep(REQ_TIMEOUT);
 	}
+	clink->depth = depth;
+	/* timeouts of a window too deep are no sign of a wedged device */
+	WRITE_ONCE(clink->timeouts_in_row, 0);
+	clink_put_slots(clink, slots, n);
+	mutex_unlock(&clink->mutex);
 
-	return -EOPNOTSUPP;
-};
+	hid_dbg(clink->hdev, "%u requests in flight\n", depth);
+}
 
-static umode_t clink_is_visible(const void *data, enum hwmon_sensor_types type,
-			      u32 attr, int channel)
+/* mean round trip of the current transport, negative errno if it does not work; mutex held */
+static s64 clink_time_transport(struct clink_device *clink, struct clink_slot *slot)
 {
-    return 0444;
-};
+	const u8 *out;
+	ktime_t start;
+	s64 total = 0;
+	int i, ret;
+
+	for (i = 0; i < CLINK_TRANSPORT_ROUNDS; i++) {
+		out = clink_depth_probe[i % ARRAY_SIZE(clink_depth_probe)];
+		slot->out_len = 0;
+		clink_record_cmd(slot, out[0], out[1]);
+
+		start = ktime_get();
+		ret = clink_send_cmd(clink, slot);
+		if (ret)
+			return ret;
+		total += ktime_to_ns(ktime_sub(slot->rx_time, start));
+	}
 
-static const struct hwmon_ops clink_hwmon_ops = {
-	.is_visible = clink_is_visible,
+	return div_s64(total, CLINK_TRANSPORT_ROUNDS);
+}
+
+/*
+ * Times one request at a time over each transport and keeps the fastest. Which one wins
+ * depends on the device and its endpoints, so the paths are measured rather than assumed.
+ * Without an interrupt OUT endpoint usbhid answers output reports with -ENOSYS and
+ * clink_send_request() takes the SET_REPORT path itself.
+ */
+static void clink_detect_transport(struct clink_device *clink)
+{
+	enum clink_transport transport, best = CLINK_TRANSPORT_OUTPUT;
+	struct clink_slot *slot;
+	unsigned int depth;
+	s64 ns;
+
+	mutex_lock(&clink->mutex);
+	slot = clink_get_slot(clink);
+	if (!slot) {
+		mutex_unlock(&clink->mutex);
+		hid_warn(clink->hdev, "no request slot to time the transports\n");
+		return;
+	}
+
+	depth = clink->depth;
+	clink->depth = 1;
+	for (transport = 0; transport < CLINK_NR_TRANSPORTS; transport++) {
+		clink->transport = transport;
+		ns = clink_time_transport(clink, slot);
+		/* the rounds fell back to the other transport, this one does not work */
+		if (clink->transport != transport && ns > 0)
+			ns = -EIO;
+		clink->transport_ns[transport] = ns;
+		/* lets a response still queued in the device drain before the next transport */
+		if (ns == -ETIMEDOUT)
+			msleep(REQ_TIMEOUT);
+		if (ns <= 0)
+			continue;
+		if (clink->transport_ns[best] <= 0 || ns < clink->transport_ns[best])
+			best = transport;
+	}
+	clink->transport = best;
+	clink->depth = depth;
+	WRITE_ONCE(clink->timeouts_in_row, 0);
+	clink_put_slot(clink, slot);
+	mutex_unlock(&clink->mutex);
+
+	hid_dbg(clink->hdev, "sending through %s\n", clink_transport_names[best]);
+}
+
+/* discovery is done after probe so binding does not wait for a USB round trip */
+static void clink_discover_work(struct work_struct *work)
+{
+	struct clink_device *clink = container_of(work, struct clink_device, discover_work);
+
+	if (!clink->depth) {
+		clink_detect_transport(clink);
+		clink_detect_depth(clink);
+	}
+	clink_verify_name(clink);
+	clink_restore(clink);
+}
+
+static int clink_select_rail(struct clink_device *clink, int rail)
+{
+	int ret;
+
+	if (rail < 0 || rail == clink->rail)
+		return 0;
+
+	ret = regmap_write(clink->regmap, REG_CHANNEL_SELECT, rail);
+	if (ret) {
+		clink->rail = -1;
+		return ret;
+	}
+
+	clink->rail = rail;
+
+	return 0;
+}
+
+static long clink_decode(u8 format, u16 raw)
+{
+	switch (format) {
+	case CLINK_FMT_UNIT:
+		return get_int_from_uint16_double(raw) / 1000;
+	case CLINK_FMT_MICRO:
+		return (long)get_int_from_uint16_double(raw) * 1000;
+	case CLINK_FMT_MILLI:
+	default:
+		return get_int_from_uint16_double(raw);
+	}
+}
+
+/* reads one sensor from the device, time is when the response arrived; mutex must be held */
+static int clink_read_sensor(struct clink_device *clink, int sensor, long *val, ktime_t *time)
+{
+	const struct clink_sensor_desc *desc = &clink_sensors[sensor];
+	unsigned int raw;
+	int ret;
+
+	ret = clink_select_rail(clink, desc->rail);
+	if (ret < 0)
+		return ret;
+
+	ret = regmap_read(clink->regmap, desc->reg, &raw);
+	if (ret < 0)
+		return ret;
+
+	*val = clink_decode(desc->format, raw);
+	*time = clink->rx_time;
+
+	return 0;
+}
+
+/* records the outcome of a sensor read in the snapshot */
+static void clink_store_sample(struct clink_device *clink, int sensor, int err, long val,
+			       ktime_t now)
+{
+	struct clink_sample *sample = &clink->samples[sensor];
+	unsigned long flags;
+	s64 dt;
+
+	/* also called from clink_raw_event() */
+	spin_lock_irqsave(&clink->sample_lock, flags);
+
+	if (err) {
+		sample->failed = true;
+		goto out;
+	}
+
+	/* trapezoidal integration of input power between two good readings */
+	if (sensor == CLINK_POWER_PS && sample->valid && val >= 0 && sample->value >= 0) {
+		dt = ktime_us_delta(now, sample->time);
+		/* 128 bit intermediate, gaps of an idle sensor last hours */
+		if (dt > 0)
+			clink->energy += mul_u64_u64_div_u64((u64)(sample->value + val) / 2, dt,
+							     USEC_PER_SEC);
+	}
+
+	sample->value = val;
+	sample->time = now;
+	sample->valid = true;
+	sample->failed = false;
+
+out:
+	spin_unlock_irqrestore(&clink->sample_lock, flags);
+}
+
+/* index in the window of the oldest request the report answers, -1 if none; lock must be held */
+static int clink_match_report(struct clink_device *clink, const u8 *data, int size)
+{
+	int i;
+
+	if (!clink->nr_inflight)
+		return -1;
+
+	for (i = 0; i < clink->nr_inflight; i++)
+		if (size >= 2 && data[0] == clink->window[i]->cmd && data[1] == clink->window[i]->reg)
+			return i;
+
+	return READ_ONCE(strict_match) ? -1 : 0;
+}
+
+/*
+ * Hands a response over to the waiting clink_transfer(). The device echoes command and
+ * register, a report that does not echo a request in flight answers somebody else's, e.g.
+ * a hidraw user's, and is only counted.
+ */
+static void clink_deliver_report(struct clink_device *clink, const u8 *data, int size)
+{
+	struct clink_slot *slot;
+	unsigned long flags;
+	bool echoed;
+	int i;
+
+	spin_lock_irqsave(&clink->lock, flags);
+
+	i = clink_match_report(clink, data, size);
+	if (i >= 0) {
+		slot = clink->window[i];
+		/* taken without echo when strict_match is off */
+		echoed = size >= 2 && data[0] == slot->cmd && data[1] == slot->reg;
+		if (!echoed)
+			clink->stats.mismatches++;
+		slot->rx_time = ktime_get();
+		slot->result = 0;
+		if (slot->sensor < 0) {
+			memcpy(slot->in, data, min(IN_BUFFER_SIZE, size));
+		} else if (echoed && size >= 4) {
+			/* sampler reads go straight into the snapshot, nobody reads the response */
+			clink_store_sample(clink, slot->sensor, 0,
+					   clink_decode(clink_sensors[slot->sensor].format,
+							(data[3] << 8) | data[2]),
+					   slot->rx_time);
+		} else {
+			/* somebody else's report is no reading of the sensor */
+			slot->result = -EIO;
+		}
+		clink->nr_inflight--;
+		memmove(&clink->window[i], &clink->window[i + 1],
+			(clink->nr_inflight - i) * sizeof(clink->window[0]));
+		if (!--clink->transfer_pending)
+			complete(&clink->transfer_done);
+	} else {
+		clink->stats.mismatches++;
+	}
+
+	spin_unlock_irqrestore(&clink->lock, flags);
+}
+
+#ifdef CONFIG_FAULT_INJECTION
+
+static DECLARE_FAULT_ATTR(clink_fail_default);
+
+static void clink_fail_delay_work(struct work_struct *work)
+{
+	struct clink_device *clink = container_of(work, struct clink_device, fail_delay_work.work);
+	struct clink_delayed_report *delayed;
+	u8 report[IN_BUFFER_SIZE];
+
+	/* delivers every response that is due and waits for the next one */
+	spin_lock_irq(&clink->lock);
+	while (clink->delayed_count) {
+		delayed = &clink->delayed[clink->delayed_head];
+		if (time_before(jiffies, delayed->due)) {
+			mod_delayed_work(system_wq, &clink->fail_delay_work, delayed->due - jiffies);
+			break;
+		}
+
+		memcpy(report, delayed->data, IN_BUFFER_SIZE);
+		clink->delayed_head = (clink->delayed_head + 1) % CLINK_FAIL_DELAYED;
+		clink->delayed_count--;
+		spin_unlock_irq(&clink->lock);
+
+		clink_deliver_report(clink, report, IN_BUFFER_SIZE);
+
+		spin_lock_irq(&clink->lock);
+	}
+	spin_unlock_irq(&clink->lock);
+}
+
+/*
+ * Applies the faults configured in debugfs to a response. Faulty responses are built in a
+ * private copy, hidraw users still see what the device sent.
+ * Returns true if the response was dropped, delayed or already delivered in altered form.
+ */
+static bool clink_inject_fault(struct clink_device *clink, const u8 *data, int size)
+{
+	u8 report[IN_BUFFER_SIZE] = { 0 };
+	struct clink_delayed_report *delayed;
+	unsigned long flags, delay_jiffies;
+	bool stale, corrupt, delay;
+
+	if (should_fail(&clink->fail_drop, 1))
+		return true;
+
+	stale = should_fail(&clink->fail_stale, 1);
+	corrupt = should_fail(&clink->fail_corrupt, 1);
+	delay = should_fail(&clink->fail_delay, 1);
+
+	spin_lock_irqsave(&clink->lock, flags);
+	if (stale) {
+		memcpy(report, clink->last_report, IN_BUFFER_SIZE);
+	} else {
+		memcpy(report, data, min(IN_BUFFER_SIZE, size));
+		memcpy(clink->last_report, report, IN_BUFFER_SIZE);
+	}
+	spin_unlock_irqrestore(&clink->lock, flags);
+
+	if (!stale && !corrupt && !delay)
+		return false;
+
+	/* keeps the echoed command and register so the response still matches its request */
+	if (corrupt) {
+		report[2] ^= 0xff;
+		report[3] ^= 0xff;
+	}
+
+	/* every delayed response is held for its own fail_delay_ms, a full ring drops it */
+	if (delay) {
+		delay_jiffies = msecs_to_jiffies(READ_ONCE(clink->fail_delay_ms));
+		spin_lock_irqsave(&clink->lock, flags);
+		if (clink->delayed_count < CLINK_FAIL_DELAYED) {
+			delayed = &clink->delayed[(clink->delayed_head + clink->delayed_count) %
+						  CLINK_FAIL_DELAYED];
+			delayed->due = jiffies + delay_jiffies;
+			memcpy(delayed->data, report, IN_BUFFER_SIZE);
+			/* the work is armed for the oldest response, later ones rearm it */
+			if (!clink->delayed_count++)
+				queue_delayed_work(system_wq, &clink->fail_delay_work, delay_jiffies);
+		}
+		spin_unlock_irqrestore(&clink->lock, flags);
+		return true;
+	}
+
+	clink_deliver_report(clink, report, IN_BUFFER_SIZE);
+
+	return true;
+}
+
+static void clink_fault_init(struct clink_device *clink)
+{
+	clink->fail_drop = clink_fail_default;
+	clink->fail_delay = clink_fail_default;
+	clink->fail_corrupt = clink_fail_default;
+	clink->fail_stale = clink_fail_default;
+	clink->fail_delay_ms = 2 * REQ_TIMEOUT;
+	INIT_DELAYED_WORK(&clink->fail_delay_work, clink_fail_delay_work);
+}
+
+static void clink_fault_debugfs_init(struct clink_device *clink)
+{
+	fault_create_debugfs_attr("fail_drop", clink->debugfs, &clink->fail_drop);
+	fault_create_debugfs_attr("fail_delay", clink->debugfs, &clink->fail_delay);
+	fault_create_debugfs_attr("fail_corrupt", clink->debugfs, &clink->fail_corrupt);
+	fault_create_debugfs_attr("fail_stale", clink->debugfs, &clink->fail_stale);
+	debugfs_create_u32("fail_delay_ms", 0600, clink->debugfs, &clink->fail_delay_ms);
+}
+
+static void clink_fault_exit(struct clink_device *clink)
+{
+	cancel_delayed_work_sync(&clink->fail_delay_work);
+}
+
+#else
+
+static bool clink_inject_fault(struct clink_device *clink, const u8 *data, int size)
+{
+	return false;
+}
+
+static void clink_fault_init(struct clink_device *clink) {}
+static void clink_fault_debugfs_init(struct clink_device *clink) {}
+static void clink_fault_exit(struct clink_device *clink) {}
+
+#endif
+
+static int clink_raw_event(struct hid_device *hdev, struct hid_report *report, u8 *data, int size)
+{
+	struct clink_device *clink = hid_get_drvdata(hdev);
+
+	clink_trace(clink, CLINK_TRACE_IN, data, min(IN_BUFFER_SIZE, size));
+
+	if (clink_inject_fault(clink, data, size))
+		return 0;
+
+	clink_deliver_report(clink, data, size);
+
+	return 0;
+}
+
+/* gets the snapshot value, with stale set also if the last read of the sensor failed */
+static bool clink_get_sample(struct clink_device *clink, int sensor, long *val, bool stale)
+{
+	bool valid;
+
+	spin_lock_irq(&clink->sample_lock);
+	valid = clink->samples[sensor].valid && (stale || !clink->samples[sensor].failed);
+	if (valid)
+		*val = clink->samples[sensor].value;
+	spin_unlock_irq(&clink->sample_lock);
+
+	return valid;
+}
+
+/* whether the sensor was read recently enough to be kept in the sampler's sweeps */
+static bool clink_sensor_active(struct clink_device *clink, int sensor, ktime_t now)
+{
+	ktime_t last = READ_ONCE(clink->last_access[sensor]);
+
+	if (!idle_timeout)
+		return true;
+
+	return last && ktime_before(now, ktime_add_ms(last, idle_timeout));
+}
+
+static bool clink_sampler_active(struct clink_device *clink)
+{
+	ktime_t now = ktime_get();
+	int sensor;
+
+	/* the fan curve needs the temperatures even when nobody reads them */
+	if (READ_ONCE(clink->fan.enable) == CLINK_PWM_CURVE)
+		return true;
+
+	for (sensor = 0; sensor < CLINK_NR_SENSORS; sensor++)
+		if (clink_sensor_active(clink, sensor, now))
+			return true;
+
+	return false;
+}
+
+/*
+ * Reads the sensors on rail that are due at tick, rail -1 being the rail independent ones.
+ * Returns the number of sensors read successfully and adds the failed ones to failed.
+ */
+static int clink_sample_rail(struct clink_device *clink, int rail, u64 tick, int *failed)
+{
+	struct clink_slot *slots[CLINK_RAIL_SENSORS];
+	int sensors[CLINK_RAIL_SENSORS];
+	const struct clink_sensor_desc *desc;
+	ktime_t now = ktime_get();
+	unsigned int period;
+	int sensor, i, n = 0, ret, err, good = 0;
+
+	for (sensor = 0; sensor < CLINK_NR_SENSORS; sensor++) {
+		desc = &clink_sensors[sensor];
+		if (desc->rail != rail || clink->next_tick[sensor] > tick ||
+		    !clink_sensor_active(clink, sensor, now) || n == CLINK_RAIL_SENSORS)
+			continue;
+
+		/* the pool holds a sweep's worth of slots, running dry only delays the sensor */
+		slots[n] = clink_get_slot(clink);
+		if (!slots[n])
+			break;
+		clink_record_cmd(slots[n], CMD_READ_REGISTER, desc->reg);
+		slots[n]->sensor = sensor;
+		sensors[n++] = sensor;
+
+		period = DIV_ROUND_UP(READ_ONCE(clink->sample_ms[sensor]), sample_interval);
+		clink->next_tick[sensor] = tick + max(period, 1U);
+	}
+
+	if (!n)
+		return 0;
+
+	/* the sensors of a rail are read in one pipelined transfer, volatile so past the regmap */
+	mutex_lock(&clink->mutex);
+	ret = clink_select_rail(clink, rail);
+	if (!ret)
+		clink_transfer(clink, slots, n);
+	mutex_unlock(&clink->mutex);
+
+	/* answered requests were stored by clink_raw_event(), only failures are left */
+	for (i = 0; i < n; i++) {
+		err = ret ?: slots[i]->result;
+		if (err)
+			clink_store_sample(clink, sensors[i], err, 0, now);
+		else
+			good++;
+	}
+
+	clink_put_slots(clink, slots, n);
+	*failed += n - good;
+
+	return good;
+}
+
+/*
+ * Reads the sensors due at tick, grouped by rail so every rail is selected at most once.
+ * The rail left selected by the previous sweep goes first to save one more selection.
+ * Returns the number of sensors read successfully, or -EIO when sensors were due and none
+ * of them could be read.
+ */
+static int clink_sample_sweep(struct clink_device *clink, u64 tick)
+{
+	int first = max(READ_ONCE(clink->rail), 0), i, good, failed = 0;
+
+	good = clink_sample_rail(clink, -1, tick, &failed);
+	for (i = 0; i < CLINK_NR_RAILS; i++)
+		good += clink_sample_rail(clink, (first + i) % CLINK_NR_RAILS, tick, &failed);
+
+	return good || !failed ? good : -EIO;
+}
+
+static void clink_account_sweep(struct clink_device *clink, ktime_t deadline, ktime_t start,
+				ktime_t end, u64 missed)
+{
+	struct clink_jitter *jitter = &clink->jitter;
+	u64 late = max_t(s64, ktime_to_ns(ktime_sub(start, deadline)), 0);
+	u64 late_us = div_u64(late, NSEC_PER_USEC);
+
+	spin_lock_irq(&clink->sample_lock);
+	jitter->sweeps++;
+	jitter->overruns += missed;
+	jitter->lateness_sum += late;
+	jitter->lateness_sq_sum += late_us * late_us;
+	jitter->lateness_max = max(jitter->lateness_max, late);
+	jitter->last_sweep = ktime_to_ns(ktime_sub(end, start));
+	spin_unlock_irq(&clink->sample_lock);
+}
+
+/* the sampler has to stop or park for suspend */
+static bool clink_sampler_interrupted(void)
+{
+	return kthread_should_stop() || kthread_should_park();
+}
+
+static int clink_scope_state(struct clink_device *clink)
+{
+	int state;
+
+	spin_lock_irq(&clink->sample_lock);
+	state = clink->scope.state;
+	spin_unlock_irq(&clink->sample_lock);
+
+	return state;
+}
+
+/* reads the scope sensor once, the reading also feeds the snapshot */
+static int clink_scope_read(struct clink_device *clink, long *val, ktime_t *time)
+{
+	int ret;
+
+	mutex_lock(&clink->mutex);
+	ret = clink_read_sensor(clink, clink->scope.sensor, val, time);
+	mutex_unlock(&clink->mutex);
+
+	clink_store_sample(clink, clink->scope.sensor, ret, *val, *time);
+
+	return ret;
+}
+
+/* puts the fan into the mode for enable at pwm, the cache skips unchanged writes; mutex must be held */
+static int clink_fan_apply(struct clink_device *clink, int enable, u8 pwm)
+{
+	struct clink_fan *fan = &clink->fan;
+	int mode, duty, ret;
+
+	/* a thermal zone asking for cooling raises the duty, it never lowers it */
+	if (fan->cooling) {
+		u8 floor = DIV_ROUND_UP(fan->cooling * 255, cooling_steps);
+
+		if (enable == CLINK_PWM_FIRMWARE) {
+			enable = CLINK_PWM_MANUAL;
+			pwm = floor;
+		} else {
+			pwm = max(pwm, floor);
+		}
+	}
+
+	mode = enable == CLINK_PWM_FIRMWARE ? 0 : 1;
+	duty = enable == CLINK_PWM_FULL ? 100 : DIV_ROUND_CLOSEST(pwm * 100, 255);
+
+	ret = regmap_update_bits(clink->regmap, REG_FAN_MODE, 0xff, mode);
+	if (ret || !mode)
+		return ret;
+
+	return regmap_update_bits(clink->regmap, REG_FAN_DUTY, 0xff, duty);
+}
+
+/* duty for temp, interpolated between the points around it */
+static u8 clink_fan_curve(const struct clink_fan *fan, long temp)
+{
+	const struct clink_fan_point *lo, *hi;
+	int i;
+
+	for (i = 0; i < CLINK_FAN_POINTS; i++)
+		if (fan->points[i].temp >= temp)
+			break;
+
+	if (i == 0)
+		return fan->points[0].pwm;
+	if (i == CLINK_FAN_POINTS)
+		return fan->points[CLINK_FAN_POINTS - 1].pwm;
+
+	lo = &fan->points[i - 1];
+	hi = &fan->points[i];
+	if (hi->temp == lo->temp)
+		return hi->pwm;
+
+	return lo->pwm + (hi->pwm - lo->pwm) * (temp - lo->temp) / (hi->temp - lo->temp);
+}
+
+/* keeps the temperatures the curve follows in the sweeps; mutex must be held */
+static void clink_fan_touch(struct clink_device *clink, ktime_t now)
+{
+	int ch;
+
+	for (ch = 0; ch < 2; ch++)
+		if (clink->fan.channels & BIT(ch))
+			WRITE_ONCE(clink->last_access[CLINK_TEMP_0 + ch], now);
+}
+
+/*
+ * Runs after every sweep: evaluates the curve and brings the fan back into the selected mode
+ * after the device lost it to a suspend or reset. Without a usable temperature the fan
+ * goes to full duty.
+ */
+static void clink_fan_update(struct clink_device *clink)
+{
+	struct clink_fan *fan = &clink->fan;
+	long temp = LONG_MIN, val;
+	ktime_t now = ktime_get();
+	int ch;
+
+	mutex_lock(&clink->mutex);
+
+	if (fan->enable == CLINK_PWM_CURVE) {
+		clink_fan_touch(clink, now);
+		for (ch = 0; ch < 2; ch++) {
+			if (!(fan->channels & BIT(ch)))
+				continue;
+			if (clink_get_sample(clink, CLINK_TEMP_0 + ch, &val, false))
+				temp = max(temp, val);
+		}
+
+		if (temp == LONG_MIN) {
+			fan->pwm = 255;
+		} else {
+			/* rises follow the temperature at once, falls only past the hysteresis */
+			fan->curve_temp = max(temp, min(fan->curve_temp, temp + fan->hyst));
+			fan->pwm = clink_fan_curve(fan, fan->curve_temp);
+		}
+	}
+
+	if (fan->enable != CLINK_PWM_FIRMWARE || fan->cooling)
+		clink_fan_apply(clink, fan->enable, fan->pwm);
+
+	mutex_unlock(&clink->mutex);
+}
+
+static int clink_get_max_state(struct thermal_cooling_device *cdev, unsigned long *state)
+{
+	*state = cooling_steps;
+
+	return 0;
+}
+
+static int clink_get_cur_state(struct thermal_cooling_device *cdev, unsigned long *state)
+{
+	struct clink_device *clink = cdev->devdata;
+
+	mutex_lock(&clink->mutex);
+	*state = clink->fan.cooling;
+	mutex_unlock(&clink->mutex);
+
+	return 0;
+}
+
+/*
+ * Kept even when it cannot be applied right away, the sampler applies it again after
+ * resume or recovery.
+ */
+static int clink_set_cur_state(struct thermal_cooling_device *cdev, unsigned long state)
+{
+	struct clink_device *clink = cdev->devdata;
+	int ret;
+
+	if (state > cooling_steps)
+		return -EINVAL;
+
+	mutex_lock(&clink->mutex);
+	clink->fan.cooling = state;
+	ret = clink_fan_apply(clink, clink->fan.enable, clink->fan.pwm);
+	mutex_unlock(&clink->mutex);
+
+	return ret;
+}
+
+static const struct thermal_cooling_device_ops clink_cooling_ops = {
+	.get_max_state = clink_get_max_state,
+	.get_cur_state = clink_get_cur_state,
+	.set_cur_state = clink_set_cur_state,
+};
+
+static void clink_scope_record(struct clink_scope *scope, long val, ktime_t time)
+{
+	struct clink_scope_record *rec = &scope->buf[scope->count++];
+
+	rec->delta_us = cpu_to_le32(ktime_us_delta(time, scope->start));
+	rec->value = cpu_to_le32((s32)clamp_val(val, S32_MIN, S32_MAX));
+}
+
+/* samples the scope sensor back to back until the duration is over or the buffer is full */
+static void clink_scope_run(struct clink_device *clink)
+{
+	struct clink_scope *scope = &clink->scope;
+	ktime_t end = ktime_add_ms(scope->start, scope->duration_ms), time = 0;
+	bool stop = false;
+	long val = 0;
+
+	while (!stop && scope->count < scope_samples && !clink_sampler_interrupted() &&
+	       ktime_before(ktime_get(), end)) {
+		if (!clink_scope_read(clink, &val, &time))
+			clink_scope_record(scope, val, time);
+
+		spin_lock_irq(&clink->sample_lock);
+		stop = scope->stop;
+		spin_unlock_irq(&clink->sample_lock);
+
+		cond_resched();
+	}
+
+	spin_lock_irq(&clink->sample_lock);
+	scope->state = CLINK_SCOPE_DONE;
+	spin_unlock_irq(&clink->sample_lock);
+}
+
+/* polls the scope sensor until deadline, starting the capture once it reaches threshold */
+static void clink_scope_poll(struct clink_device *clink, ktime_t deadline)
+{
+	struct clink_scope *scope = &clink->scope;
+	ktime_t time = 0;
+	bool triggered;
+	long val = 0;
+
+	while (!clink_sampler_interrupted() && ktime_before(ktime_get(), deadline)) {
+		if (clink_scope_read(clink, &val, &time)) {
+			cond_resched();
+			continue;
+		}
+
+		spin_lock_irq(&clink->sample_lock);
+		if (scope->state != CLINK_SCOPE_ARMED) {
+			spin_unlock_irq(&clink->sample_lock);
+			return;
+		}
+		triggered = val >= scope->threshold;
+		if (triggered) {
+			scope->start = time;
+			scope->state = CLINK_SCOPE_RUNNING;
+		}
+		spin_unlock_irq(&clink->sample_lock);
+
+		if (triggered) {
+			clink_scope_record(scope, val, time);
+			clink_scope_run(clink);
+			return;
+		}
+
+		cond_resched();
+	}
+}
+
+#ifdef CONFIG_PM
+/* whether userspace let the device autosuspend, restored on remove */
+static bool clink_autosuspend_allowed(struct usb_device *udev)
+{
+	return udev->dev.power.runtime_auto;
+}
+
+/* a negative delay keeps the device from autosuspending */
+static int clink_autosuspend_delay(struct usb_device *udev)
+{
+	return READ_ONCE(udev->dev.power.autosuspend_delay);
+}
+#else
+static bool clink_autosuspend_allowed(struct usb_device *udev)
+{
+	return false;
+}
+
+static int clink_autosuspend_delay(struct usb_device *udev)
+{
+	return -1;
+}
+#endif
+
+/*
+ * Closes the device when the sampler has nothing to do before deadline for long enough to let
+ * it autosuspend and resume again, KTIME_MAX meaning the sampler goes idle. Returns when the
+ * sampler has to wake up: the average resume time ahead of deadline if the device was closed.
+ * Once that time has come the device is resumed, just in time for the sweep at deadline.
+ */
+static ktime_t clink_link_park(struct clink_device *clink, ktime_t deadline)
+{
+	int delay;
+	s64 gap;
+	ktime_t wake = deadline;
+
+	if (!clink->udev)
+		return deadline;
+
+	delay = clink_autosuspend_delay(clink->udev);
+	if (delay < 0)
+		return deadline;
+
+	gap = ktime_to_ns(ktime_sub(deadline, ktime_get()));
+
+	mutex_lock(&clink->mutex);
+	if (gap > (s64)(2 * clink->resume_ns) + (s64)delay * NSEC_PER_MSEC) {
+		clink_hw_close(clink);
+		if (deadline != KTIME_MAX)
+			wake = ktime_sub_ns(deadline, clink->resume_ns);
+	} else if (deadline != KTIME_MAX) {
+		clink_hw_open(clink);
+	}
+	mutex_unlock(&clink->mutex);
+
+	return wake;
+}
+
+/*
+ * Waits until deadline, returns early when the thread is asked to stop. Scope captures are
+ * served while waiting, an armed scope keeps polling its sensor in between sweeps. With no
+ * sensor read for idle_timeout the sampler sleeps until a read wakes it up, and it parks
+ * here for suspend; both are reported by returning true.
+ */
+static bool clink_sampler_wait(struct clink_device *clink, ktime_t deadline)
+{
+	bool idled = false, active;
+	ktime_t wake;
+	s64 left;
+
+	for (;;) {
+		if (kthread_should_park()) {
+			kthread_parkme();
+			idled = true;
+			break;
+		}
+
+		if (kthread_should_stop() || !ktime_before(ktime_get(), deadline))
+			break;
+
+		switch (clink_scope_state(clink)) {
+		case CLINK_SCOPE_RUNNING:
+			clink_scope_run(clink);
+			continue;
+		case CLINK_SCOPE_ARMED:
+			clink_scope_poll(clink, deadline);
+			continue;
+		default:
+			break;
+		}
+
+		active = clink_sampler_active(clink);
+		wake = clink_link_park(clink, active ? deadline : KTIME_MAX);
+
+		/* the state is checked again after going to sleep so a wakeup is not lost */
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (clink_sampler_interrupted() || clink_scope_state(clink) == CLINK_SCOPE_RUNNING ||
+		    clink_scope_state(clink) == CLINK_SCOPE_ARMED ||
+		    active != clink_sampler_active(clink)) {
+			__set_current_state(TASK_RUNNING);
+			continue;
+		}
+
+		/* woken up by a read or by kthread_park(), which the next pass tells apart */
+		if (!active) {
+			schedule();
+			idled = true;
+			continue;
+		}
+
+		if (precise_sampling) {
+			schedule_hrtimeout_range(&wake, 0, HRTIMER_MODE_ABS);
+			continue;
+		}
+
+		left = ktime_us_delta(wake, ktime_get());
+		schedule_timeout(left > 0 ? usecs_to_jiffies(left) : 0);
+		__set_current_state(TASK_RUNNING);
+	}
+
+	return idled;
+}
+
+/*
+ * Recovers a device that stopped answering: a USB device is reset, and the sweep after
+ * that rediscovers the device like after a resume. The timeouts keep counting, so the
+ * sampler stays backed off and users do not wait, until the device answers again.
+ */
+static void clink_recover(struct clink_device *clink)
+{
+	struct hid_device *hdev = clink->hdev;
+
+	hid_warn(hdev, "no response to %u requests, recovering\n", clink->timeouts_in_row);
+
+	/* queued, usbcore takes care of a reset that ends up rebinding the driver */
+	if (hid_is_usb(hdev))
+		usb_queue_reset_device(to_usb_interface(hdev->dev.parent));
+
+	mutex_lock(&clink->mutex);
+	clink->rail = -1;
+	regcache_mark_dirty(clink->regmap);
+	/* a device that stays dead is reset ever more rarely */
+	clink->recoveries_in_row++;
+	clink->recover_at = clink->timeouts_in_row +
+		(reset_threshold << min(clink->recoveries_in_row, (unsigned int)MAX_BACKOFF_SHIFT));
+	clink->stats.recoveries++;
+	mutex_unlock(&clink->mutex);
+
+	set_bit(CLINK_STATE_RESUMED, &clink->state);
+}
+
+static bool clink_recovery_due(struct clink_device *clink)
+{
+	unsigned int timeouts = READ_ONCE(clink->timeouts_in_row);
+
+	if (!reset_threshold)
+		return false;
+	if (!READ_ONCE(clink->recoveries_in_row))
+		return timeouts >= reset_threshold;
+
+	return timeouts >= READ_ONCE(clink->recover_at);
+}
+
+/* sweeps are spaced out exponentially while the device does not answer */
+static unsigned int clink_backoff_shift(struct clink_device *clink)
+{
+	return min(READ_ONCE(clink->timeouts_in_row), (unsigned int)MAX_BACKOFF_SHIFT);
+}
+
+/*
+ * Every device samples from its own thread, so a device stalling for REQ_TIMEOUT on each
+ * request does not delay, and skew the timestamps of, the samples of the other devices.
+ *
+ * Sweeps start on a fixed grid of sample_interval. When a long sweep or a scope capture
+ * kept the sampler busy past further slots, it skips to the last slot already begun,
+ * keeping the phase of the grid.
+ */
+static int clink_sampler(void *data)
+{
+	struct clink_device *clink = data;
+	u64 interval = (u64)sample_interval * NSEC_PER_MSEC;
+	ktime_t deadline = ktime_get(), start, end;
+	u64 missed, tick = 0;
+	bool idled;
+	int good;
+
+	for (;;) {
+		idled = clink_sampler_wait(clink, deadline);
+		if (kthread_should_stop())
+			break;
+
+		start = ktime_get();
+		/* after idling the grid starts over, the slots slept through were not missed */
+		if (idled)
+			deadline = start;
+		missed = div64_u64(ktime_to_ns(ktime_sub(start, deadline)), interval);
+		deadline = ktime_add_ns(deadline, missed * interval);
+
+		/* after resume every sensor still sampled is read in the first sweep */
+		if (test_and_clear_bit(CLINK_STATE_RESUMED, &clink->state)) {
+			clink_verify_name(clink);
+			clink_restore(clink);
+			memset(clink->next_tick, 0, sizeof(clink->next_tick));
+		}
+
+		tick += missed;
+		good = clink_sample_sweep(clink, tick);
+		end = ktime_get();
+		/*
+		 * The snapshot stays marked stale until some of it is fresh. With nothing due it is
+		 * not served anymore either, readers go to the device and wake the sampler up.
+		 */
+		if (good >= 0)
+			clear_bit(CLINK_STATE_STALE, &clink->state);
+
+		clink_fan_update(clink);
+
+		clink_account_sweep(clink, deadline, start, end, missed);
+
+		if (clink_recovery_due(clink))
+			clink_recover(clink);
+
+		deadline = ktime_add_ns(deadline, interval << clink_backoff_shift(clink));
+		tick++;
+	}
+
+	return 0;
+}
+
+static int clink_sampler_start(struct clink_device *clink)
+{
+	struct task_struct *task;
+	cpumask_var_t mask;
+	int ret;
+
+	task = kthread_create(clink_sampler, clink, "clink/%u", clink->hdev->id);
+	if (IS_ERR(task))
+		return PTR_ERR(task);
+
+	if (sampler_fifo)
+		sched_set_fifo_low(task);
+	else
+		set_user_nice(task, clamp(sampler_nice, MIN_NICE, MAX_NICE));
+
+	if (sampler_cpus && alloc_cpumask_var(&mask, GFP_KERNEL)) {
+		ret = cpulist_parse(sampler_cpus, mask);
+		if (!ret)
+			ret = set_cpus_allowed_ptr(task, mask);
+		if (ret)
+			hid_warn(clink->hdev, "cannot bind sampler to cpus %s: %d\n", sampler_cpus, ret);
+		free_cpumask_var(mask);
+	}
+
+	clink->sampler = task;
+	wake_up_process(task);
+
+	return 0;
+}
+
+static void clink_sampler_stop(struct clink_device *clink)
+{
+	if (clink->sampler)
+		kthread_stop(clink->sampler);
+	clink->sampler = NULL;
+}
+
+static int clink_sensor_index(enum hwmon_sensor_types type, int channel)
+{
+	switch (type) {
+	case hwmon_temp:
+		return CLINK_TEMP_0 + channel;
+	case hwmon_fan:
+		return CLINK_FAN;
+	case hwmon_in:
+		return CLINK_VOLTAGE_PS + channel;
+	case hwmon_curr:
+		return CLINK_CURRENT_12V + channel;
+	case hwmon_power:
+		return CLINK_POWER_PS + channel;
+	default:
+		return -EOPNOTSUPP;
+	}
+}
+
+static int clink_read_string(struct device *dev, enum hwmon_sensor_types type,
+			   u32 attr, int channel, const char **str)
+{
+	switch (type) {
+		case hwmon_in:
+			switch (attr) {
+			case hwmon_in_label:
+				*str = voltage_labels[channel];
+				return 0;
+			default:
+				break;
+			}
+			break;
+
+		case hwmon_power:
+			switch (attr) {
+			case hwmon_power_label:
+				*str = power_labels[channel];
+				return 0;
+			default:
+				break;
+			}
+			break;
+
+		case hwmon_curr:
+			switch (attr) {
+				case hwmon_curr_label:
+					*str = current_labels[channel];
+					return 0;
+				default:
+					break;
+			}
+			break;
+
+		case hwmon_energy:
+			switch (attr) {
+				case hwmon_energy_label:
+					*str = energy_labels[channel];
+					return 0;
+				default:
+					break;
+			}
+			break;
+
+
+		default:
+			break;
+	}
+
+	return -EOPNOTSUPP;
+}
+
+/*
+ * Returns the current value of a sensor for a user. The snapshot is used while the sampler
+ * keeps the sensor up to date, otherwise the device is read and a sampler gone idle is
+ * woken up to take the sensor back into its sweeps. With serve_stale the last good value is
+ * returned rather than waiting for the device, whenever there is one.
+ */
+static int clink_sensor_value(struct clink_device *clink, int sensor, long *val)
+{
+	ktime_t time = 0, now = ktime_get();
+	bool active;
+	int ret;
+
+	active = clink_sensor_active(clink, sensor, now);
+	WRITE_ONCE(clink->last_access[sensor], now);
+
+	/* the last snapshot is served until the first sweep after resume is done */
+	if (test_bit(CLINK_STATE_STALE, &clink->state) && clink_get_sample(clink, sensor, val, true)) {
+		/* which the sampler only does for sensors in its sweeps */
+		if (!active && clink->sampler)
+			wake_up_process(clink->sampler);
+		return 0;
+	}
+
+	if (!clink->sampler && test_and_clear_bit(CLINK_STATE_RESUMED, &clink->state))
+		clink_verify_name(clink);
+
+	if (sample_interval && active && clink_get_sample(clink, sensor, val, false))
+		return 0;
+
+	if (!active && clink->sampler)
+		wake_up_process(clink->sampler);
+
+	if (READ_ONCE(serve_stale) && clink->sampler && clink_get_sample(clink, sensor, val, true))
+		return 0;
+
+	/* users do not wait on a device that stopped answering, the sampler keeps trying */
+	if (clink->sampler && READ_ONCE(clink->timeouts_in_row) >= WEDGED_TIMEOUTS) {
+		ret = -ETIMEDOUT;
+	} else {
+		mutex_lock(&clink->mutex);
+		ret = clink_read_sensor(clink, sensor, val, &time);
+		mutex_unlock(&clink->mutex);
+
+		clink_store_sample(clink, sensor, ret, *val, time);
+	}
+
+	/* without a sampler the device has to be asked, a failure still falls back */
+	if (ret && READ_ONCE(serve_stale) && clink_get_sample(clink, sensor, val, true))
+		return 0;
+
+	return ret;
+}
+
+static int clink_read_pwm(struct clink_device *clink, u32 attr, long *val)
+{
+	int ret = 0;
+
+	mutex_lock(&clink->mutex);
+	switch (attr) {
+	case hwmon_pwm_input:
+		*val = clink->fan.pwm;
+		break;
+	case hwmon_pwm_enable:
+		*val = clink->fan.enable;
+		break;
+	case hwmon_pwm_auto_channels_temp:
+		*val = clink->fan.channels;
+		break;
+	default:
+		ret = -EOPNOTSUPP;
+	}
+	mutex_unlock(&clink->mutex);
+
+	return ret;
+}
+
+static int clink_read(struct device *dev, enum hwmon_sensor_types type,
+		    u32 attr, int channel, long *val)
+{
+	struct clink_device *clink = dev_get_drvdata(dev);
+	long power;
+
+	switch (type) {
+	case hwmon_temp:
+	case hwmon_fan:
+	case hwmon_in:
+	case hwmon_curr:
+	case hwmon_power:
+		/* only the *_input attributes are read, labels go through read_string */
+		break;
+	case hwmon_energy:
+		/* energy is integrated from input power, reading it keeps that sampled */
+		clink_sensor_value(clink, CLINK_POWER_PS, &power);
+		spin_lock_irq(&clink->sample_lock);
+		*val = clink->energy;
+		spin_unlock_irq(&clink->sample_lock);
+		return 0;
+	case hwmon_pwm:
+		return clink_read_pwm(clink, attr, val);
+	default:
+		return -EOPNOTSUPP;
+	}
+
+	return clink_sensor_value(clink, clink_sensor_index(type, channel), val);
+}
+
+static int clink_write(struct device *dev, enum hwmon_sensor_types type,
+		     u32 attr, int channel, long val)
+{
+	struct clink_device *clink = dev_get_drvdata(dev);
+	struct clink_fan *fan = &clink->fan;
+	int ret = 0;
+
+	if (type != hwmon_pwm)
+		return -EOPNOTSUPP;
+
+	switch (attr) {
+	case hwmon_pwm_input:
+		if (val < 0 || val > 255)
+			return -EINVAL;
+		break;
+	case hwmon_pwm_enable:
+		if (val < CLINK_PWM_FULL || val > CLINK_PWM_CURVE)
+			return -EINVAL;
+		/* the curve is run by the sampler */
+		if (val == CLINK_PWM_CURVE && !clink->sampler)
+			return -EOPNOTSUPP;
+		break;
+	case hwmon_pwm_auto_channels_temp:
+		if (val < 1 || val > 3)
+			return -EINVAL;
+		break;
+	default:
+		return -EOPNOTSUPP;
+	}
+
+	mutex_lock(&clink->mutex);
+
+	switch (attr) {
+	case hwmon_pwm_input:
+		if (fan->enable == CLINK_PWM_MANUAL)
+			ret = clink_fan_apply(clink, fan->enable, val);
+		if (!ret)
+			fan->pwm = val;
+		break;
+	case hwmon_pwm_enable:
+		ret = clink_fan_apply(clink, val, fan->pwm);
+		if (ret)
+			break;
+		WRITE_ONCE(fan->enable, val);
+		fan->curve_temp = LONG_MIN;
+		break;
+	case hwmon_pwm_auto_channels_temp:
+		fan->channels = val;
+		break;
+	}
+
+	/* the sweep the first curve evaluation follows has to read the temperatures */
+	if (!ret && fan->enable == CLINK_PWM_CURVE)
+		clink_fan_touch(clink, ktime_get());
+
+	mutex_unlock(&clink->mutex);
+
+	/* the first curve evaluation should not wait for the next tick */
+	if (!ret && clink->sampler && fan->enable == CLINK_PWM_CURVE)
+		wake_up_process(clink->sampler);
+
+	return ret;
+}
+
+static ssize_t sample_ms_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct clink_device *clink = dev_get_drvdata(dev);
+
+	return sysfs_emit(buf, "%u\n", READ_ONCE(clink->sample_ms[to_sensor_dev_attr(attr)->index]));
+}
+
+/* takes effect after the next read of the sensor */
+static ssize_t sample_ms_store(struct device *dev, struct device_attribute *attr,
+			       const char *buf, size_t count)
+{
+	struct clink_device *clink = dev_get_drvdata(dev);
+	unsigned int val;
+	int ret;
+
+	ret = kstrtouint(buf, 0, &val);
+	if (ret)
+		return ret;
+
+	WRITE_ONCE(clink->sample_ms[to_sensor_dev_attr(attr)->index], val);
+
+	return count;
+}
+
+static SENSOR_DEVICE_ATTR_RW(temp1_sample_ms, sample_ms, CLINK_TEMP_0);
+static SENSOR_DEVICE_ATTR_RW(temp2_sample_ms, sample_ms, CLINK_TEMP_1);
+static SENSOR_DEVICE_ATTR_RW(fan1_sample_ms, sample_ms, CLINK_FAN);
+static SENSOR_DEVICE_ATTR_RW(in0_sample_ms, sample_ms, CLINK_VOLTAGE_PS);
+static SENSOR_DEVICE_ATTR_RW(in1_sample_ms, sample_ms, CLINK_VOLTAGE_12V);
+static SENSOR_DEVICE_ATTR_RW(in2_sample_ms, sample_ms, CLINK_VOLTAGE_5V);
+static SENSOR_DEVICE_ATTR_RW(in3_sample_ms, sample_ms, CLINK_VOLTAGE_3V3);
+static SENSOR_DEVICE_ATTR_RW(curr1_sample_ms, sample_ms, CLINK_CURRENT_12V);
+static SENSOR_DEVICE_ATTR_RW(curr2_sample_ms, sample_ms, CLINK_CURRENT_5V);
+static SENSOR_DEVICE_ATTR_RW(curr3_sample_ms, sample_ms, CLINK_CURRENT_3V3);
+static SENSOR_DEVICE_ATTR_RW(power1_sample_ms, sample_ms, CLINK_POWER_PS);
+static SENSOR_DEVICE_ATTR_RW(power2_sample_ms, sample_ms, CLINK_POWER_12V);
+static SENSOR_DEVICE_ATTR_RW(power3_sample_ms, sample_ms, CLINK_POWER_5V);
+static SENSOR_DEVICE_ATTR_RW(power4_sample_ms, sample_ms, CLINK_POWER_3V3);
+
+static ssize_t device_name_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct clink_device *clink = dev_get_drvdata(dev);
+	ssize_t ret = -ENODATA;
+
+	mutex_lock(&clink->mutex);
+	if (test_bit(CLINK_STATE_NAMED, &clink->state))
+		ret = sysfs_emit(buf, "%.*s\n", (int)sizeof(clink->name), clink->name);
+	mutex_unlock(&clink->mutex);
+
+	return ret;
+}
+
+static DEVICE_ATTR_RO(device_name);
+
+/* over current protection of the +12V output, 1 single rail, 2 one limit per connector */
+static ssize_t rail_mode_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct clink_device *clink = dev_get_drvdata(dev);
+	unsigned int mode;
+	int ret;
+
+	/* only the first read goes to the device */
+	mutex_lock(&clink->mutex);
+	ret = regmap_read(clink->regmap, REG_RAIL, &mode);
+	mutex_unlock(&clink->mutex);
+
+	if (ret)
+		return ret;
+
+	return sysfs_emit(buf, "%u\n", mode);
+}
+
+static ssize_t rail_mode_store(struct device *dev, struct device_attribute *attr,
+			       const char *buf, size_t count)
+{
+	struct clink_device *clink = dev_get_drvdata(dev);
+	u8 mode;
+	int ret;
+
+	ret = kstrtou8(buf, 0, &mode);
+	if (ret)
+		return ret;
+	if (mode != 1 && mode != 2)
+		return -EINVAL;
+
+	mutex_lock(&clink->mutex);
+	ret = regmap_write(clink->regmap, REG_RAIL, mode);
+	mutex_unlock(&clink->mutex);
+
+	return ret ? ret : count;
+}
+
+static DEVICE_ATTR_RW(rail_mode);
+
+/* age of the oldest snapshot value among the sensors being sampled */
+static ssize_t sample_age_ms_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct clink_device *clink = dev_get_drvdata(dev);
+	ktime_t now = ktime_get(), oldest = now;
+	bool found = false;
+	int sensor;
+
+	spin_lock_irq(&clink->sample_lock);
+	for (sensor = 0; sensor < CLINK_NR_SENSORS; sensor++) {
+		if (!clink->samples[sensor].valid || !clink_sensor_active(clink, sensor, now))
+			continue;
+		oldest = min(oldest, clink->samples[sensor].time);
+		found = true;
+	}
+	spin_unlock_irq(&clink->sample_lock);
+
+	if (!found)
+		return -ENODATA;
+
+	return sysfs_emit(buf, "%lld\n", ktime_ms_delta(now, oldest));
+}
+
+static DEVICE_ATTR_RO(sample_age_ms);
+
+/* 1 while values from before a suspend are served or the last read of a sensor failed */
+static ssize_t stale_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct clink_device *clink = dev_get_drvdata(dev);
+	bool stale = test_bit(CLINK_STATE_STALE, &clink->state);
+	ktime_t now = ktime_get();
+	int sensor;
+
+	spin_lock_irq(&clink->sample_lock);
+	for (sensor = 0; sensor < CLINK_NR_SENSORS; sensor++)
+		if (clink->samples[sensor].failed && clink_sensor_active(clink, sensor, now))
+			stale = true;
+	spin_unlock_irq(&clink->sample_lock);
+
+	return sysfs_emit(buf, "%d\n", stale);
+}
+
+static DEVICE_ATTR_RO(stale);
+
+static ssize_t auto_point_temp_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct clink_device *clink = dev_get_drvdata(dev);
+	long temp;
+
+	mutex_lock(&clink->mutex);
+	temp = clink->fan.points[to_sensor_dev_attr(attr)->index].temp;
+	mutex_unlock(&clink->mutex);
+
+	return sysfs_emit(buf, "%ld\n", temp);
+}
+
+static ssize_t auto_point_temp_store(struct device *dev, struct device_attribute *attr,
+				     const char *buf, size_t count)
+{
+	struct clink_device *clink = dev_get_drvdata(dev);
+	long val;
+	int ret;
+
+	ret = kstrtol(buf, 0, &val);
+	if (ret)
+		return ret;
+
+	mutex_lock(&clink->mutex);
+	clink->fan.points[to_sensor_dev_attr(attr)->index].temp = clamp_val(val, -273150, 200000);
+	mutex_unlock(&clink->mutex);
+
+	return count;
+}
+
+static ssize_t auto_point_pwm_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct clink_device *clink = dev_get_drvdata(dev);
+	u8 pwm;
+
+	mutex_lock(&clink->mutex);
+	pwm = clink->fan.points[to_sensor_dev_attr(attr)->index].pwm;
+	mutex_unlock(&clink->mutex);
+
+	return sysfs_emit(buf, "%u\n", pwm);
+}
+
+static ssize_t auto_point_pwm_store(struct device *dev, struct device_attribute *attr,
+				    const char *buf, size_t count)
+{
+	struct clink_device *clink = dev_get_drvdata(dev);
+	u8 val;
+	int ret;
+
+	ret = kstrtou8(buf, 0, &val);
+	if (ret)
+		return ret;
+
+	mutex_lock(&clink->mutex);
+	clink->fan.points[to_sensor_dev_attr(attr)->index].pwm = val;
+	mutex_unlock(&clink->mutex);
+
+	return count;
+}
+
+static ssize_t pwm1_auto_point_temp_hyst_show(struct device *dev, struct device_attribute *attr,
+					      char *buf)
+{
+	struct clink_device *clink = dev_get_drvdata(dev);
+	long hyst;
+
+	mutex_lock(&clink->mutex);
+	hyst = clink->fan.hyst;
+	mutex_unlock(&clink->mutex);
+
+	return sysfs_emit(buf, "%ld\n", hyst);
+}
+
+static ssize_t pwm1_auto_point_temp_hyst_store(struct device *dev, struct device_attribute *attr,
+					       const char *buf, size_t count)
+{
+	struct clink_device *clink = dev_get_drvdata(dev);
+	long val;
+	int ret;
+
+	ret = kstrtol(buf, 0, &val);
+	if (ret)
+		return ret;
+
+	mutex_lock(&clink->mutex);
+	clink->fan.hyst = clamp_val(val, 0, 50000);
+	mutex_unlock(&clink->mutex);
+
+	return count;
+}
+
+static SENSOR_DEVICE_ATTR_RW(pwm1_auto_point1_temp, auto_point_temp, 0);
+static SENSOR_DEVICE_ATTR_RW(pwm1_auto_point1_pwm, auto_point_pwm, 0);
+static SENSOR_DEVICE_ATTR_RW(pwm1_auto_point2_temp, auto_point_temp, 1);
+static SENSOR_DEVICE_ATTR_RW(pwm1_auto_point2_pwm, auto_point_pwm, 1);
+static SENSOR_DEVICE_ATTR_RW(pwm1_auto_point3_temp, auto_point_temp, 2);
+static SENSOR_DEVICE_ATTR_RW(pwm1_auto_point3_pwm, auto_point_pwm, 2);
+static SENSOR_DEVICE_ATTR_RW(pwm1_auto_point4_temp, auto_point_temp, 3);
+static SENSOR_DEVICE_ATTR_RW(pwm1_auto_point4_pwm, auto_point_pwm, 3);
+static SENSOR_DEVICE_ATTR_RW(pwm1_auto_point5_temp, auto_point_temp, 4);
+static SENSOR_DEVICE_ATTR_RW(pwm1_auto_point5_pwm, auto_point_pwm, 4);
+static DEVICE_ATTR_RW(pwm1_auto_point_temp_hyst);
+
+static struct attribute *clink_attrs[] = {
+	&dev_attr_device_name.attr,
+	&dev_attr_rail_mode.attr,
+	&dev_attr_sample_age_ms.attr,
+	&dev_attr_stale.attr,
+	&sensor_dev_attr_temp1_sample_ms.dev_attr.attr,
+	&sensor_dev_attr_temp2_sample_ms.dev_attr.attr,
+	&sensor_dev_attr_fan1_sample_ms.dev_attr.attr,
+	&sensor_dev_attr_in0_sample_ms.dev_attr.attr,
+	&sensor_dev_attr_in1_sample_ms.dev_attr.attr,
+	&sensor_dev_attr_in2_sample_ms.dev_attr.attr,
+	&sensor_dev_attr_in3_sample_ms.dev_attr.attr,
+	&sensor_dev_attr_curr1_sample_ms.dev_attr.attr,
+	&sensor_dev_attr_curr2_sample_ms.dev_attr.attr,
+	&sensor_dev_attr_curr3_sample_ms.dev_attr.attr,
+	&sensor_dev_attr_power1_sample_ms.dev_attr.attr,
+	&sensor_dev_attr_power2_sample_ms.dev_attr.attr,
+	&sensor_dev_attr_power3_sample_ms.dev_attr.attr,
+	&sensor_dev_attr_power4_sample_ms.dev_attr.attr,
+	&sensor_dev_attr_pwm1_auto_point1_temp.dev_attr.attr,
+	&sensor_dev_attr_pwm1_auto_point1_pwm.dev_attr.attr,
+	&sensor_dev_attr_pwm1_auto_point2_temp.dev_attr.attr,
+	&sensor_dev_attr_pwm1_auto_point2_pwm.dev_attr.attr,
+	&sensor_dev_attr_pwm1_auto_point3_temp.dev_attr.attr,
+	&sensor_dev_attr_pwm1_auto_point3_pwm.dev_attr.attr,
+	&sensor_dev_attr_pwm1_auto_point4_temp.dev_attr.attr,
+	&sensor_dev_attr_pwm1_auto_point4_pwm.dev_attr.attr,
+	&sensor_dev_attr_pwm1_auto_point5_temp.dev_attr.attr,
+	&sensor_dev_attr_pwm1_auto_point5_pwm.dev_attr.attr,
+	&dev_attr_pwm1_auto_point_temp_hyst.attr,
+	NULL
+};
+
+/* the sample periods and the fan curve only mean something with the sampler running */
+static umode_t clink_attr_is_visible(struct kobject *kobj, struct attribute *attr, int n)
+{
+	if (attr == &dev_attr_device_name.attr || attr == &dev_attr_rail_mode.attr)
+		return attr->mode;
+
+	return sample_interval ? attr->mode : 0;
+}
+
+static const struct attribute_group clink_group = {
+	.attrs = clink_attrs,
+	.is_visible = clink_attr_is_visible,
+};
+__ATTRIBUTE_GROUPS(clink);
+
+static umode_t clink_is_visible(const void *data, enum hwmon_sensor_types type,
+			      u32 attr, int channel)
+{
+    if (type == hwmon_pwm)
+        return 0644;
+
+    return 0444;
+};
+
+static const struct hwmon_ops clink_hwmon_ops = {
+	.is_visible = clink_is_visible,
 	.read = clink_read,
 	.read_string = clink_read_string,
+	.write = clink_write,
+};
+
+static const struct hwmon_channel_info *corsairlink_info[] = {
+    HWMON_CHANNEL_INFO(chip,
+			   HWMON_C_REGISTER_TZ),
+	HWMON_CHANNEL_INFO(temp,
+			   HWMON_T_INPUT,
+			   HWMON_T_INPUT
+			   ),
+	HWMON_CHANNEL_INFO(fan,
+               HWMON_F_LABEL|HWMON_F_INPUT
+			   ),
+	HWMON_CHANNEL_INFO(in,
+               HWMON_I_LABEL|HWMON_I_INPUT,
+			   HWMON_I_LABEL|HWMON_I_INPUT,
+               HWMON_I_LABEL|HWMON_I_INPUT,
+               HWMON_I_LABEL|HWMON_I_INPUT
+			   ),
+	HWMON_CHANNEL_INFO(curr,
+			   HWMON_C_LABEL|HWMON_C_INPUT,
+               HWMON_C_LABEL|HWMON_C_INPUT,
+               HWMON_C_LABEL|HWMON_C_INPUT
+			   ),
+	HWMON_CHANNEL_INFO(power,
+               HWMON_P_LABEL|HWMON_P_INPUT,
+			   HWMON_P_LABEL|HWMON_P_INPUT,
+               HWMON_P_LABEL|HWMON_P_INPUT,
+               HWMON_P_LABEL|HWMON_P_INPUT
+			   ),
+	HWMON_CHANNEL_INFO(energy,
+			   HWMON_E_LABEL|HWMON_E_INPUT
+			   ),
+	HWMON_CHANNEL_INFO(pwm,
+			   HWMON_PWM_INPUT|HWMON_PWM_ENABLE|HWMON_PWM_AUTO_CHANNELS_TEMP
+			   ),
+	NULL
+};
+
+static const struct hwmon_chip_info clink_chip_info = {
+	.ops = &clink_hwmon_ops,
+	.info = corsairlink_info,
+};
+
+/*
+ * Keeps a sensor in the sampler's sweeps for a reader that only looks at the snapshot, waking
+ * a sampler that dropped it for being idle.
+ */
+static void clink_touch_sensor(struct clink_device *clink, int sensor, ktime_t now)
+{
+	bool active = clink_sensor_active(clink, sensor, now);
+
+	WRITE_ONCE(clink->last_access[sensor], now);
+	if (!active && clink->sampler)
+		wake_up_process(clink->sampler);
+}
+
+/*
+ * corsairlink_total sums power, current and energy over all bound devices. It is computed
+ * from the snapshots kept by the samplers and never reads a device; reading it keeps the
+ * summed sensors in the sweeps. A device whose last read failed adds its last good value.
+ */
+static int clink_total_read(struct device *dev, enum hwmon_sensor_types type,
+		    u32 attr, int channel, long *val)
+{
+	struct clink_device *clink;
+	ktime_t now = ktime_get();
+	int sensor, found = 0;
+	long sum = 0, value;
+
+	/* snapshots only: no USB traffic, and nothing slow under clink_list_lock */
+	if (type == hwmon_energy) {
+		mutex_lock(&clink_list_lock);
+		sum = clink_energy_retired;
+		list_for_each_entry(clink, &clink_list, node) {
+			/* energy is integrated from input power, which has to stay sampled */
+			clink_touch_sensor(clink, CLINK_POWER_PS, now);
+			spin_lock_irq(&clink->sample_lock);
+			sum += clink->energy;
+			spin_unlock_irq(&clink->sample_lock);
+		}
+		mutex_unlock(&clink_list_lock);
+
+		*val = sum;
+		return 0;
+	}
+
+	sensor = clink_sensor_index(type, channel);
+	if (sensor < 0)
+		return sensor;
+
+	mutex_lock(&clink_list_lock);
+	list_for_each_entry(clink, &clink_list, node) {
+		clink_touch_sensor(clink, sensor, now);
+		if (clink_get_sample(clink, sensor, &value, true)) {
+			sum += value;
+			found++;
+		}
+	}
+	mutex_unlock(&clink_list_lock);
+
+	if (!found)
+		return -ENODATA;
+
+	*val = sum;
+
+	return 0;
+}
+
+static umode_t clink_total_is_visible(const void *data, enum hwmon_sensor_types type,
+			      u32 attr, int channel)
+{
+    return 0444;
+}
+
+static const struct hwmon_ops clink_total_hwmon_ops = {
+	.is_visible = clink_total_is_visible,
+	.read = clink_total_read,
+	.read_string = clink_read_string,
+};
+
+static const struct hwmon_channel_info *corsairlink_total_info[] = {
+	HWMON_CHANNEL_INFO(curr,
+			   HWMON_C_LABEL|HWMON_C_INPUT,
+			   HWMON_C_LABEL|HWMON_C_INPUT,
+			   HWMON_C_LABEL|HWMON_C_INPUT
+			   ),
+	HWMON_CHANNEL_INFO(power,
+			   HWMON_P_LABEL|HWMON_P_INPUT,
+			   HWMON_P_LABEL|HWMON_P_INPUT,
+			   HWMON_P_LABEL|HWMON_P_INPUT,
+			   HWMON_P_LABEL|HWMON_P_INPUT
+			   ),
+	HWMON_CHANNEL_INFO(energy,
+			   HWMON_E_LABEL|HWMON_E_INPUT
+			   ),
+	NULL
+};
+
+static const struct hwmon_chip_info clink_total_chip_info = {
+	.ops = &clink_total_hwmon_ops,
+	.info = corsairlink_total_info,
+};
+
+static int clink_total_register(void)
+{
+	clink_total_pdev = platform_device_register_simple("corsairlink_total",
+							   PLATFORM_DEVID_NONE, NULL, 0);
+	if (IS_ERR(clink_total_pdev))
+		return PTR_ERR(clink_total_pdev);
+
+	clink_total_hwmon = hwmon_device_register_with_info(&clink_total_pdev->dev,
+							    "corsairlink_total", NULL,
+							    &clink_total_chip_info, NULL);
+	if (IS_ERR(clink_total_hwmon)) {
+		platform_device_unregister(clink_total_pdev);
+		return PTR_ERR(clink_total_hwmon);
+	}
+
+	return 0;
+}
+
+static void clink_total_unregister(void)
+{
+	hwmon_device_unregister(clink_total_hwmon);
+	platform_device_unregister(clink_total_pdev);
+}
+
+static int clink_stats_show(struct seq_file *seqf, void *unused)
+{
+	struct clink_device *clink = seqf->private;
+
+	seq_printf(seqf, "model %s\n", clink->model->family);
+	mutex_lock(&clink->mutex);
+	seq_printf(seqf, "transactions %llu\n", clink->stats.transactions);
+	seq_printf(seqf, "timeouts %llu\n", clink->stats.timeouts);
+	seq_printf(seqf, "timeouts_in_row %u\n", clink->timeouts_in_row);
+	seq_printf(seqf, "recoveries %llu\n", clink->stats.recoveries);
+	seq_printf(seqf, "recoveries_in_row %u\n", clink->recoveries_in_row);
+	seq_printf(seqf, "batches %llu\n", clink->stats.batches);
+	seq_printf(seqf, "mismatches %llu\n", clink->stats.mismatches);
+	seq_printf(seqf, "depth %u\n", clink->depth);
+	seq_printf(seqf, "errors %llu\n", clink->stats.errors);
+	seq_printf(seqf, "stale %d\n", test_bit(CLINK_STATE_STALE, &clink->state));
+	seq_printf(seqf, "link_closes %llu\n", clink->stats.link_closes);
+	seq_printf(seqf, "resumes %llu\n", clink->stats.resumes);
+	seq_printf(seqf, "resume_ns %llu\n", clink->resume_ns);
+	mutex_unlock(&clink->mutex);
+	seq_printf(seqf, "capture_dropped %llu\n", READ_ONCE(clink->stats.capture_dropped));
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(clink_stats);
+
+/* transport in use and the round trip measured for each, 0 if not timed or a negative errno */
+static int clink_transport_show(struct seq_file *seqf, void *unused)
+{
+	struct clink_device *clink = seqf->private;
+	enum clink_transport transport;
+
+	mutex_lock(&clink->mutex);
+	seq_printf(seqf, "transport %s\n", clink_transport_names[clink->transport]);
+	for (transport = 0; transport < CLINK_NR_TRANSPORTS; transport++)
+		seq_printf(seqf, "%s_ns %lld\n", clink_transport_names[transport],
+			   clink->transport_ns[transport]);
+	mutex_unlock(&clink->mutex);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(clink_transport);
+
+/* cached configuration registers, without a round trip to the device */
+static int clink_registers_show(struct seq_file *seqf, void *unused)
+{
+	struct clink_device *clink = seqf->private;
+	unsigned int val;
+	int i;
+
+	mutex_lock(&clink->mutex);
+	regcache_cache_only(clink->regmap, true);
+	for (i = 0; i < ARRAY_SIZE(clink_cached_regs); i++) {
+		if (regmap_read(clink->regmap, clink_cached_regs[i], &val))
+			seq_printf(seqf, "%02x: not cached\n", clink_cached_regs[i]);
+		else
+			seq_printf(seqf, "%02x: %04x\n", clink_cached_regs[i], val);
+	}
+	regcache_cache_only(clink->regmap, false);
+	mutex_unlock(&clink->mutex);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(clink_registers);
+
+static int clink_jitter_show(struct seq_file *seqf, void *unused)
+{
+	struct clink_device *clink = seqf->private;
+	struct clink_jitter jitter;
+	u64 mean = 0, mean_us, var = 0;
+
+	spin_lock_irq(&clink->sample_lock);
+	jitter = clink->jitter;
+	spin_unlock_irq(&clink->sample_lock);
+
+	if (jitter.sweeps) {
+		mean = div64_u64(jitter.lateness_sum, jitter.sweeps);
+		mean_us = div_u64(mean, NSEC_PER_USEC);
+		var = div64_u64(jitter.lateness_sq_sum, jitter.sweeps);
+		var = var > mean_us * mean_us ? var - mean_us * mean_us : 0;
+	}
+
+	seq_printf(seqf, "mode %s\n", precise_sampling ? "hrtimer" : "jiffies");
+	seq_printf(seqf, "interval_ns %llu\n", (u64)sample_interval * NSEC_PER_MSEC);
+	seq_printf(seqf, "sweeps %llu\n", jitter.sweeps);
+	seq_printf(seqf, "overruns %llu\n", jitter.overruns);
+	seq_printf(seqf, "lateness_mean_ns %llu\n", mean);
+	seq_printf(seqf, "lateness_stddev_ns %llu\n", (u64)int_sqrt64(var) * NSEC_PER_USEC);
+	seq_printf(seqf, "lateness_max_ns %llu\n", jitter.lateness_max);
+	seq_printf(seqf, "last_sweep_ns %llu\n", jitter.last_sweep);
+
+	return 0;
+}
+
+static int clink_jitter_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, clink_jitter_show, inode->i_private);
+}
+
+/* any write resets the statistics */
+static ssize_t clink_jitter_write(struct file *file, const char __user *buf, size_t count,
+				  loff_t *ppos)
+{
+	struct clink_device *clink = ((struct seq_file *)file->private_data)->private;
+
+	spin_lock_irq(&clink->sample_lock);
+	memset(&clink->jitter, 0, sizeof(clink->jitter));
+	spin_unlock_irq(&clink->sample_lock);
+
+	return count;
+}
+
+static int clink_scope_show(struct seq_file *seqf, void *unused)
+{
+	static const char * const states[] = { "idle", "armed", "running", "done" };
+	struct clink_device *clink = seqf->private;
+	struct clink_scope *scope = &clink->scope;
+
+	spin_lock_irq(&clink->sample_lock);
+	seq_printf(seqf, "state %s\n", states[scope->state]);
+	seq_printf(seqf, "sensor %s\n", clink_sensor_names[scope->sensor]);
+	seq_printf(seqf, "duration_ms %u\n", scope->duration_ms);
+	seq_printf(seqf, "threshold %ld\n", scope->threshold);
+	seq_printf(seqf, "samples %u\n", scope->count);
+	spin_unlock_irq(&clink->sample_lock);
+
+	return 0;
+}
+
+static int clink_scope_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, clink_scope_show, inode->i_private);
+}
+
+/*
+ * Accepts "start <sensor> <duration_ms>", "arm <sensor> <duration_ms> <threshold>" and
+ * "stop", sensor being a hwmon attribute name like power1 or curr1.
+ */
+static ssize_t clink_scope_write(struct file *file, const char __user *ubuf, size_t count,
+				 loff_t *ppos)
+{
+	struct clink_device *clink = ((struct seq_file *)file->private_data)->private;
+	struct clink_scope *scope = &clink->scope;
+	char buf[64], cmd[8], name[16];
+	u32 duration = 0;
+	long threshold = 0;
+	int sensor, n, ret;
+
+	if (count >= sizeof(buf))
+		return -EINVAL;
+	if (copy_from_user(buf, ubuf, count))
+		return -EFAULT;
+	buf[count] = 0;
+
+	n = sscanf(buf, "%7s %15s %u %ld", cmd, name, &duration, &threshold);
+	if (n < 1)
+		return -EINVAL;
+
+	if (!strcmp(cmd, "stop")) {
+		spin_lock_irq(&clink->sample_lock);
+		if (scope->state == CLINK_SCOPE_ARMED)
+			scope->state = CLINK_SCOPE_DONE;
+		else if (scope->state == CLINK_SCOPE_RUNNING)
+			scope->stop = true;
+		spin_unlock_irq(&clink->sample_lock);
+		return count;
+	}
+
+	if (!((!strcmp(cmd, "start") && n == 3) || (!strcmp(cmd, "arm") && n == 4)) || !duration)
+		return -EINVAL;
+
+	sensor = match_string(clink_sensor_names, CLINK_NR_SENSORS, name);
+	if (sensor < 0)
+		return sensor;
+
+	if (!scope_samples)
+		return -ENOSPC;
+
+	mutex_lock(&scope->lock);
+	mutex_lock(&clink->mutex);
+
+	/* the buffer is allocated on first use and kept until the device goes away */
+	ret = 0;
+	if (!scope->buf) {
+		scope->buf = kvcalloc(scope_samples, sizeof(*scope->buf), GFP_KERNEL);
+		if (!scope->buf)
+			ret = -ENOMEM;
+	}
+
+	spin_lock_irq(&clink->sample_lock);
+	if (!ret && (scope->state == CLINK_SCOPE_ARMED || scope->state == CLINK_SCOPE_RUNNING))
+		ret = -EBUSY;
+	if (!ret) {
+		scope->sensor = sensor;
+		scope->duration_ms = duration;
+		scope->threshold = threshold;
+		scope->count = 0;
+		scope->stop = false;
+		scope->start = ktime_get();
+		scope->state = n == 4 ? CLINK_SCOPE_ARMED : CLINK_SCOPE_RUNNING;
+	}
+	spin_unlock_irq(&clink->sample_lock);
+
+	mutex_unlock(&clink->mutex);
+	mutex_unlock(&scope->lock);
+
+	if (ret)
+		return ret;
+
+	wake_up_process(clink->sampler);
+
+	return count;
+}
+
+static const struct file_operations clink_scope_fops = {
+	.owner = THIS_MODULE,
+	.open = clink_scope_open,
+	.read = seq_read,
+	.write = clink_scope_write,
+	.llseek = seq_lseek,
+	.release = single_release,
 };
 
-static const struct hwmon_channel_info *corsairlink_info[] = {
-    HWMON_CHANNEL_INFO(chip,
-			   HWMON_C_REGISTER_TZ),
-	HWMON_CHANNEL_INFO(temp,
-			   HWMON_T_INPUT,
-			   HWMON_T_INPUT
-			   ),
-	HWMON_CHANNEL_INFO(fan,
-               HWMON_F_LABEL|HWMON_F_INPUT
-			   ),
-	HWMON_CHANNEL_INFO(in,
-               HWMON_I_LABEL|HWMON_I_INPUT,
-			   HWMON_I_LABEL|HWMON_I_INPUT,
-               HWMON_I_LABEL|HWMON_I_INPUT,
-               HWMON_I_LABEL|HWMON_I_INPUT
-			   ),
-	HWMON_CHANNEL_INFO(curr,
-			   HWMON_C_LABEL|HWMON_C_INPUT,
-               HWMON_C_LABEL|HWMON_C_INPUT,
-               HWMON_C_LABEL|HWMON_C_INPUT
-			   ),
-	HWMON_CHANNEL_INFO(power,
-               HWMON_P_LABEL|HWMON_P_INPUT,
-			   HWMON_P_LABEL|HWMON_P_INPUT,
-               HWMON_P_LABEL|HWMON_P_INPUT,
-               HWMON_P_LABEL|HWMON_P_INPUT
-			   ),
-	NULL
+/* header and records of the last finished capture */
+static ssize_t clink_scope_data_read(struct file *file, char __user *buf, size_t count,
+				     loff_t *ppos)
+{
+	struct clink_device *clink = file->private_data;
+	struct clink_scope *scope = &clink->scope;
+	struct clink_scope_header hdr;
+	ssize_t ret, done;
+	int state;
+
+	/* an idle or finished capture stays so while the lock is held, the sampler leaves buf alone */
+	mutex_lock(&scope->lock);
+
+	spin_lock_irq(&clink->sample_lock);
+	state = scope->state;
+	spin_unlock_irq(&clink->sample_lock);
+
+	if (state == CLINK_SCOPE_ARMED || state == CLINK_SCOPE_RUNNING) {
+		ret = -EBUSY;
+		goto out_unlock;
+	}
+
+	memcpy(hdr.magic, CLINK_SCOPE_MAGIC, sizeof(hdr.magic));
+	hdr.version = cpu_to_le16(CLINK_SCOPE_VERSION);
+	hdr.sensor = scope->sensor;
+	hdr.reserved = 0;
+	hdr.count = cpu_to_le32(scope->count);
+	hdr.start_ns = cpu_to_le64(ktime_to_ns(scope->start));
+
+	done = simple_read_from_buffer(buf, count, ppos, &hdr, sizeof(hdr));
+	if (done < 0 || *ppos < sizeof(hdr) || !scope->buf) {
+		ret = done;
+		goto out_unlock;
+	}
+
+	/* the records follow the header in the file */
+	*ppos -= sizeof(hdr);
+	ret = simple_read_from_buffer(buf + done, count - done, ppos, scope->buf,
+				      scope->count * sizeof(*scope->buf));
+	*ppos += sizeof(hdr);
+
+	if (ret < 0)
+		ret = done ? done : ret;
+	else
+		ret += done;
+
+out_unlock:
+	mutex_unlock(&scope->lock);
+
+	return ret;
+}
+
+static const struct file_operations clink_scope_data_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.read = clink_scope_data_read,
+	.llseek = default_llseek,
 };
 
-static const struct hwmon_chip_info clink_chip_info = {
-	.ops = &clink_hwmon_ops,
-	.info = corsairlink_info,
+static const struct file_operations clink_jitter_fops = {
+	.owner = THIS_MODULE,
+	.open = clink_jitter_open,
+	.read = seq_read,
+	.write = clink_jitter_write,
+	.llseek = seq_lseek,
+	.release = single_release,
 };
 
-static int corsairlink_clink_name(
-    struct clink_device* clink)
+static int clink_capture_get(void *data, u64 *val)
 {
-    int ret;
+	struct clink_device *clink = data;
+
+	*val = READ_ONCE(clink->capture);
+
+	return 0;
+}
+
+static int clink_capture_set(void *data, u64 val)
+{
+	struct clink_device *clink = data;
+	int ret = 0;
+
+	mutex_lock(&clink->mutex);
 
-    clink_record_cmd(clink, CMD_READ_REGISTER, REG_DEVICE_NAME);
-    ret = clink_send_cmd(clink);
-    if (ret < 0)
-        return ret;
+	/* the buffer is allocated on first use and kept until the device goes away */
+	if (val && !kfifo_initialized(&clink->trace))
+		ret = kfifo_alloc(&clink->trace, capture_size, GFP_KERNEL);
 
-    memcpy(clink->name, clink->buffer + 2, sizeof(clink->name));
+	if (!ret) {
+		spin_lock_irq(&clink->trace_lock);
+		if (val && !clink->capture)
+			clink->trace_last = ktime_get();
+		WRITE_ONCE(clink->capture, !!val);
+		spin_unlock_irq(&clink->trace_lock);
+	}
+
+	mutex_unlock(&clink->mutex);
 
-    return 0;
+	return ret;
 }
+DEFINE_DEBUGFS_ATTRIBUTE(clink_capture_fops, clink_capture_get, clink_capture_set, "%llu\n");
 
-static int clink_probe(struct hid_device *hdev, const struct hid_device_id *id)
+/* consumes captured records, each read starting at offset 0 is prefixed with the header */
+static ssize_t clink_trace_read(struct file *file, char __user *buf, size_t count, loff_t *ppos)
+{
+	struct clink_device *clink = file->private_data;
+	struct clink_trace_header hdr;
+	size_t done = 0;
+	unsigned int len;
+	u8 *bounce;
+
+	if (*ppos == 0) {
+		if (count < sizeof(hdr))
+			return -EINVAL;
+
+		memcpy(hdr.magic, CLINK_TRACE_MAGIC, sizeof(hdr.magic));
+		hdr.version = cpu_to_le16(CLINK_TRACE_VERSION);
+		hdr.product = cpu_to_le16(clink->hdev->product);
+		if (copy_to_user(buf, &hdr, sizeof(hdr)))
+			return -EFAULT;
+
+		done = sizeof(hdr);
+	}
+
+	if (!kfifo_initialized(&clink->trace) || done == count)
+		goto out;
+
+	bounce = kmalloc(PAGE_SIZE, GFP_KERNEL);
+	if (!bounce)
+		return -ENOMEM;
+
+	spin_lock_irq(&clink->trace_lock);
+	len = kfifo_out(&clink->trace, bounce, min_t(size_t, count - done, PAGE_SIZE));
+	spin_unlock_irq(&clink->trace_lock);
+
+	if (copy_to_user(buf + done, bounce, len))
+		len = 0;
+	done += len;
+
+	kfree(bounce);
+
+out:
+	*ppos += done;
+
+	return done;
+}
+
+static const struct file_operations clink_trace_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.read = clink_trace_read,
+};
+
+static void clink_debugfs_init(struct clink_device *clink)
+{
+	clink->debugfs = debugfs_create_dir(dev_name(&clink->hdev->dev), clink_debugfs_root);
+	debugfs_create_file("stats", 0444, clink->debugfs, clink, &clink_stats_fops);
+	debugfs_create_file_unsafe("capture", 0600, clink->debugfs, clink, &clink_capture_fops);
+	debugfs_create_file("trace", 0400, clink->debugfs, clink, &clink_trace_fops);
+	debugfs_create_file("transport", 0444, clink->debugfs, clink, &clink_transport_fops);
+	debugfs_create_file("registers", 0444, clink->debugfs, clink, &clink_registers_fops);
+	if (clink->sampler) {
+		debugfs_create_file("jitter", 0600, clink->debugfs, clink, &clink_jitter_fops);
+		debugfs_create_file("scope", 0600, clink->debugfs, clink, &clink_scope_fops);
+		debugfs_create_file("scope_data", 0400, clink->debugfs, clink,
+				    &clink_scope_data_fops);
+	}
+	clink_fault_debugfs_init(clink);
+}
+
+/*
+ * The character device outlives the driver binding while a file is open, a batch after remove
+ * finds clink cleared and fails.
+ */
+struct clink_chardev {
+	struct miscdevice misc;
+	struct kref ref;
+	struct mutex lock; /* protects clink */
+	struct clink_device *clink; /* NULL once the device is removed */
+	int index; /* N of /dev/corsairlink<N> */
+	char name[32];
+};
+
+/* numbers the character devices from 0, hdev->id counts every HID device in the system */
+static DEFINE_IDA(clink_chardev_ida);
+
+static void clink_chardev_free(struct kref *ref)
+{
+	kfree(container_of(ref, struct clink_chardev, ref));
+}
+
+static int clink_chardev_open(struct inode *inode, struct file *file)
+{
+	struct clink_chardev *chardev = container_of(file->private_data, struct clink_chardev, misc);
+
+	kref_get(&chardev->ref);
+	file->private_data = chardev;
+
+	return nonseekable_open(inode, file);
+}
+
+static int clink_chardev_release(struct inode *inode, struct file *file)
+{
+	struct clink_chardev *chardev = file->private_data;
+
+	kref_put(&chardev->ref, clink_chardev_free);
+
+	return 0;
+}
+
+/* runs one op of a batch; mutex must be held */
+static int clink_run_op(struct clink_device *clink, struct clink_slot *slot, struct clink_op *op)
+{
+	int ret;
+
+	/* unused bits stay zero so they can be given a meaning later */
+	if (op->flags || op->reserved[0] || op->reserved[1])
+		return -EINVAL;
+
+	slot->out_len = 0;
+
+	switch (op->cmd) {
+	case CLINK_OP_READ:
+		clink_record_cmd(slot, CMD_READ_REGISTER, op->reg);
+		break;
+	case CLINK_OP_WRITE:
+		if (!op->len || op->len > CLINK_OP_DATA_SIZE)
+			return -EINVAL;
+		clink_record_cmd(slot, CMD_WRITE_REGISTER, op->reg);
+		memcpy(slot->out + slot->out_len, op->data, op->len);
+		slot->out_len += op->len;
+
+		/* the driver reads back what the tool changed instead of trusting its cache */
+		if (op->reg == REG_CHANNEL_SELECT)
+			clink->rail = -1;
+		regcache_drop_region(clink->regmap, op->reg, op->reg);
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	ret = clink_send_cmd(clink, slot);
+	if (ret < 0)
+		return ret;
+
+	memcpy(op->data, slot->in + 2, CLINK_OP_DATA_SIZE);
+	op->len = CLINK_OP_DATA_SIZE;
+
+	return 0;
+}
+
+static long clink_chardev_batch(struct clink_chardev *chardev, struct clink_batch __user *ubatch)
 {
 	struct clink_device *clink;
+	struct clink_batch batch;
+	struct clink_slot *slot;
+	struct clink_op *ops;
+	size_t size;
+	int ret = 0;
+
+	if (copy_from_user(&batch, ubatch, sizeof(batch)))
+		return -EFAULT;
+	if (!batch.nr_ops || batch.nr_ops > CLINK_MAX_OPS)
+		return -EINVAL;
+
+	size = batch.nr_ops * sizeof(*ops);
+	ops = memdup_user(u64_to_user_ptr(batch.ops), size);
+	if (IS_ERR(ops))
+		return PTR_ERR(ops);
+
+	mutex_lock(&chardev->lock);
+	clink = chardev->clink;
+	if (!clink) {
+		ret = -ENODEV;
+		goto out_unlock;
+	}
+
+	mutex_lock(&clink->mutex);
+	slot = clink_get_slot(clink);
+	if (!slot) {
+		mutex_unlock(&clink->mutex);
+		ret = -EBUSY;
+		goto out_unlock;
+	}
+
+	for (batch.nr_done = 0; batch.nr_done < batch.nr_ops; ) {
+		ret = clink_run_op(clink, slot, &ops[batch.nr_done]);
+		ops[batch.nr_done++].result = ret;
+		if (ret)
+			break;
+	}
+	clink->stats.batches++;
+	clink_put_slot(clink, slot);
+	mutex_unlock(&clink->mutex);
+
+	ret = 0;
+	if (copy_to_user(u64_to_user_ptr(batch.ops), ops, size) ||
+	    put_user(batch.nr_done, &ubatch->nr_done))
+		ret = -EFAULT;
+
+out_unlock:
+	mutex_unlock(&chardev->lock);
+	kfree(ops);
+
+	return ret;
+}
+
+static long clink_chardev_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+	struct clink_chardev *chardev = file->private_data;
+
+	switch (cmd) {
+	case CLINK_IOC_BATCH:
+		return clink_chardev_batch(chardev, (struct clink_batch __user *)arg);
+	default:
+		return -ENOTTY;
+	}
+}
+
+static const struct file_operations clink_chardev_fops = {
+	.owner = THIS_MODULE,
+	.open = clink_chardev_open,
+	.release = clink_chardev_release,
+	.unlocked_ioctl = clink_chardev_ioctl,
+	.compat_ioctl = compat_ptr_ioctl,
+};
+
+static int clink_chardev_init(struct clink_device *clink)
+{
+	struct clink_chardev *chardev;
 	int ret;
 
+	chardev = kzalloc(sizeof(*chardev), GFP_KERNEL);
+	if (!chardev)
+		return -ENOMEM;
+
+	chardev->index = ida_alloc(&clink_chardev_ida, GFP_KERNEL);
+	if (chardev->index < 0) {
+		ret = chardev->index;
+		kfree(chardev);
+		return ret;
+	}
+
+	kref_init(&chardev->ref);
+	mutex_init(&chardev->lock);
+	chardev->clink = clink;
+	snprintf(chardev->name, sizeof(chardev->name), "corsairlink%d", chardev->index);
+	chardev->misc.minor = MISC_DYNAMIC_MINOR;
+	chardev->misc.name = chardev->name;
+	chardev->misc.fops = &clink_chardev_fops;
+	chardev->misc.parent = &clink->hdev->dev;
+	chardev->misc.mode = 0600;
+
+	ret = misc_register(&chardev->misc);
+	if (ret) {
+		ida_free(&clink_chardev_ida, chardev->index);
+		kfree(chardev);
+		return ret;
+	}
+
+	clink->chardev = chardev;
+
+	return 0;
+}
+
+static void clink_chardev_exit(struct clink_device *clink)
+{
+	struct clink_chardev *chardev = clink->chardev;
+
+	if (!chardev)
+		return;
+
+	misc_deregister(&chardev->misc);
+	ida_free(&clink_chardev_ida, chardev->index);
+
+	/* waits for a batch still running */
+	mutex_lock(&chardev->lock);
+	chardev->clink = NULL;
+	mutex_unlock(&chardev->lock);
+
+	kref_put(&chardev->ref, clink_chardev_free);
+}
+
+static int clink_probe(struct hid_device *hdev, const struct hid_device_id *id)
+{
+	struct clink_device *clink;
+	int i, ret;
+
 	clink = devm_kzalloc(&hdev->dev, sizeof(*clink), GFP_KERNEL);
 	if (!clink)
 		return -ENOMEM;
 
-	clink->buffer = devm_kmalloc(&hdev->dev, OUT_BUFFER_SIZE, GFP_KERNEL);
-	if (!clink->buffer)
-		return -ENOMEM;
+	/* separate allocations, the buffers are handed to the USB core for DMA */
+	for (i = 0; i < CLINK_NR_SLOTS; i++) {
+		clink->slots[i].report = devm_kzalloc(&hdev->dev, OUT_BUFFER_SIZE + 1, GFP_KERNEL);
+		clink->slots[i].in = devm_kmalloc(&hdev->dev, IN_BUFFER_SIZE, GFP_KERNEL);
+		if (!clink->slots[i].report || !clink->slots[i].in)
+			return -ENOMEM;
+		clink->slots[i].out = clink->slots[i].report + 1;
+	}
+	clink->free_slots = GENMASK(CLINK_NR_SLOTS - 1, 0);
 
 	ret = hid_parse(hdev);
 	if (ret)
@@ -479,26 +3374,87 @@ static int clink_probe(struct hid_device *hdev, const struct hid_device_id *id)
 		goto out_hw_stop;
 
 	clink->hdev = hdev;
-    clink->command_index = 0;
+	clink->opened = true;
+	clink->rail = -1;
+	clink->model = (const struct clink_model *)id->driver_data;
+	for (i = 0; i < CLINK_NR_SENSORS; i++)
+		clink->sample_ms[i] = clink->model->sample_ms[i];
+	clink->scope.sensor = CLINK_POWER_PS;
+	clink->fan.enable = CLINK_PWM_FIRMWARE;
+	clink->fan.pwm = 255;
+	memcpy(clink->fan.points, clink_default_curve, sizeof(clink->fan.points));
+	clink->fan.channels = 3;
+	clink->fan.hyst = 3000;
 	hid_set_drvdata(hdev, clink);
 	mutex_init(&clink->mutex);
-	init_completion(&clink->wait_input_report);
+	mutex_init(&clink->scope.lock);
+	spin_lock_init(&clink->lock);
+	spin_lock_init(&clink->trace_lock);
+	spin_lock_init(&clink->sample_lock);
+	init_completion(&clink->transfer_done);
+	INIT_WORK(&clink->discover_work, clink_discover_work);
+	clink_fault_init(clink);
+
+	clink->regmap = devm_regmap_init(&hdev->dev, &clink_regmap_bus, clink, &clink_regmap_config);
+	if (IS_ERR(clink->regmap)) {
+		ret = PTR_ERR(clink->regmap);
+		goto out_hw_close;
+	}
 
 	hid_device_io_start(hdev);
 
-    ret = corsairlink_clink_name(clink);
-	if (ret)
-		goto out_hw_close;
-
 	clink->hwmon_dev = hwmon_device_register_with_info(&hdev->dev, "corsairlink",
-							 clink, &clink_chip_info, 0);
+							 clink, &clink_chip_info, clink_groups);
 	if (IS_ERR(clink->hwmon_dev)) {
 		ret = PTR_ERR(clink->hwmon_dev);
 		goto out_hw_close;
 	}
 
+	/*
+	 * Only the sampler closes the device, without it there is nothing to gain. Set up before
+	 * the sampler starts, which looks at udev.
+	 */
+	if (IS_ENABLED(CONFIG_PM) && autosuspend && sample_interval && hid_is_usb(hdev)) {
+		clink->udev = interface_to_usbdev(to_usb_interface(hdev->dev.parent));
+		clink->autosuspend_was_on = clink_autosuspend_allowed(clink->udev);
+		usb_enable_autosuspend(clink->udev);
+	}
+
+	if (sample_interval) {
+		ret = clink_sampler_start(clink);
+		if (ret)
+			goto out_autosuspend;
+	}
+
+	/* optional, the fan stays usable through pwm1 without it */
+	if (cooling_steps) {
+		clink->cdev = thermal_cooling_device_register("corsairlink-fan", clink,
+							      &clink_cooling_ops);
+		if (IS_ERR(clink->cdev)) {
+			hid_warn(hdev, "cannot register cooling device: %ld\n", PTR_ERR(clink->cdev));
+			clink->cdev = NULL;
+		}
+	}
+
+	clink_debugfs_init(clink);
+
+	ret = clink_chardev_init(clink);
+	if (ret)
+		hid_warn(hdev, "cannot register character device: %d\n", ret);
+
+	mutex_lock(&clink_list_lock);
+	list_add_tail(&clink->node, &clink_list);
+	mutex_unlock(&clink_list_lock);
+
+	/* depth and transport detection may block for seconds */
+	queue_work(system_long_wq, &clink->discover_work);
+
 	return 0;
 
+out_autosuspend:
+	if (clink->udev && !clink->autosuspend_was_on)
+		usb_disable_autosuspend(clink->udev);
+	hwmon_device_unregister(clink->hwmon_dev);
 out_hw_close:
 	hid_hw_close(hdev);
 out_hw_stop:
@@ -509,38 +3465,117 @@ out_hw_stop:
 static void clink_remove(struct hid_device *hdev)
 {
 	struct clink_device *clink = hid_get_drvdata(hdev);
-
+	u64 energy;
+
+	/*
+	 * Off the list first, corsairlink_total wakes the sampler of every listed device. The
+	 * energy is handed over right away so the total does not drop meanwhile, and what is
+	 * integrated until the device stops is added once it has.
+	 */
+	mutex_lock(&clink_list_lock);
+	list_del(&clink->node);
+	spin_lock_irq(&clink->sample_lock);
+	energy = clink->energy;
+	spin_unlock_irq(&clink->sample_lock);
+	clink_energy_retired += energy;
+	mutex_unlock(&clink_list_lock);
+
+	clink_chardev_exit(clink);
+	debugfs_remove_recursive(clink->debugfs);
+	if (clink->cdev)
+		thermal_cooling_device_unregister(clink->cdev);
 	hwmon_device_unregister(clink->hwmon_dev);
-	hid_hw_close(hdev);
+	cancel_work_sync(&clink->discover_work);
+	clink_sampler_stop(clink);
+
+	/* hands the fan back to the PSU */
+	mutex_lock(&clink->mutex);
+	if (clink->fan.enable != CLINK_PWM_FIRMWARE || clink->fan.cooling) {
+		clink->fan.cooling = 0;
+		clink_fan_apply(clink, CLINK_PWM_FIRMWARE, 0);
+	}
+	mutex_unlock(&clink->mutex);
+
+	clink_hw_close(clink);
+	if (clink->udev && !clink->autosuspend_was_on)
+		usb_disable_autosuspend(clink->udev);
+	/* raw_event may arm the delayed delivery until the device is stopped */
 	hid_hw_stop(hdev);
+	clink_fault_exit(clink);
+
+	mutex_lock(&clink_list_lock);
+	clink_energy_retired += clink->energy - energy;
+	mutex_unlock(&clink_list_lock);
+
+	kfifo_free(&clink->trace);
+	kvfree(clink->scope.buf);
 }
-/*
+
+#ifdef CONFIG_PM
 static int clink_suspend(struct hid_device *hdev, pm_message_t message)
 {
-    struct clink_device *clink = hid_get_drvdata(hdev);
+	struct clink_device *clink = hid_get_drvdata(hdev);
 
-    hwmon_device_unregister(clink->hwmon_dev);
-    hid_hw_close(hdev);
-    hid_hw_stop(hdev);
+	/* usbhid takes care of runtime suspend and resumes the device for the next report */
+	if (PMSG_IS_AUTO(message))
+		return 0;
+
+	set_bit(CLINK_STATE_STALE, &clink->state);
+	if (cancel_work_sync(&clink->discover_work))
+		set_bit(CLINK_STATE_DISCOVER, &clink->state);
+	if (clink->sampler)
+		kthread_park(clink->sampler);
+
+	/* waits for transactions still in flight */
+	mutex_lock(&clink->mutex);
+	set_bit(CLINK_STATE_SUSPENDED, &clink->state);
+	mutex_unlock(&clink->mutex);
+
+	return 0;
 }
 
-int (*resume)(struct hid_device *hdev);
-int (*reset_resume)(struct hid_device *hdev);
-*/
+/* also used for reset_resume, a reset loses the selected rail the same way a power cut does */
+static int clink_resume(struct hid_device *hdev)
+{
+	struct clink_device *clink = hid_get_drvdata(hdev);
+
+	if (!test_bit(CLINK_STATE_SUSPENDED, &clink->state))
+		return 0;
+
+	mutex_lock(&clink->mutex);
+	clink->rail = -1;
+	regcache_mark_dirty(clink->regmap);
+	clear_bit(CLINK_STATE_SUSPENDED, &clink->state);
+	mutex_unlock(&clink->mutex);
+
+	set_bit(CLINK_STATE_RESUMED, &clink->state);
+	if (clink->sampler) {
+		kthread_unpark(clink->sampler);
+		if (test_and_clear_bit(CLINK_STATE_DISCOVER, &clink->state))
+			queue_work(system_long_wq, &clink->discover_work);
+	} else {
+		clear_bit(CLINK_STATE_STALE, &clink->state);
+		clear_bit(CLINK_STATE_DISCOVER, &clink->state);
+		queue_work(system_long_wq, &clink->discover_work);
+	}
+
+	return 0;
+}
+#endif
 
 
 static const struct hid_device_id clink_devices[] = {
-	{ HID_USB_DEVICE(USB_VENDOR_ID_CORSAIR, 0x1c09) }, /* RM550i */
-    { HID_USB_DEVICE(USB_VENDOR_ID_CORSAIR, 0x1c0a) }, /* RM650i */
-    { HID_USB_DEVICE(USB_VENDOR_ID_CORSAIR, 0x1c0b) }, /* RM750i */
-    { HID_USB_DEVICE(USB_VENDOR_ID_CORSAIR, 0x1c0c) }, /* RM850i */
-    { HID_USB_DEVICE(USB_VENDOR_ID_CORSAIR, 0x1c0d) }, /* RM1000i */
-    { HID_USB_DEVICE(USB_VENDOR_ID_CORSAIR, 0x1c03) }, /* HX550i */
-    { HID_USB_DEVICE(USB_VENDOR_ID_CORSAIR, 0x1c04) }, /* HX650i */
-    { HID_USB_DEVICE(USB_VENDOR_ID_CORSAIR, 0x1c05) }, /* HX750i */
-    { HID_USB_DEVICE(USB_VENDOR_ID_CORSAIR, 0x1c06) }, /* HX850i */
-    { HID_USB_DEVICE(USB_VENDOR_ID_CORSAIR, 0x1c07) }, /* HX1000i */
-    { HID_USB_DEVICE(USB_VENDOR_ID_CORSAIR, 0x1c08) }, /* HX1200i */
+	{ HID_USB_DEVICE(USB_VENDOR_ID_CORSAIR, 0x1c09), .driver_data = (kernel_ulong_t)&clink_model_rmi }, /* RM550i */
+    { HID_USB_DEVICE(USB_VENDOR_ID_CORSAIR, 0x1c0a), .driver_data = (kernel_ulong_t)&clink_model_rmi }, /* RM650i */
+    { HID_USB_DEVICE(USB_VENDOR_ID_CORSAIR, 0x1c0b), .driver_data = (kernel_ulong_t)&clink_model_rmi }, /* RM750i */
+    { HID_USB_DEVICE(USB_VENDOR_ID_CORSAIR, 0x1c0c), .driver_data = (kernel_ulong_t)&clink_model_rmi }, /* RM850i */
+    { HID_USB_DEVICE(USB_VENDOR_ID_CORSAIR, 0x1c0d), .driver_data = (kernel_ulong_t)&clink_model_rmi }, /* RM1000i */
+    { HID_USB_DEVICE(USB_VENDOR_ID_CORSAIR, 0x1c03), .driver_data = (kernel_ulong_t)&clink_model_hxi }, /* HX550i */
+    { HID_USB_DEVICE(USB_VENDOR_ID_CORSAIR, 0x1c04), .driver_data = (kernel_ulong_t)&clink_model_hxi }, /* HX650i */
+    { HID_USB_DEVICE(USB_VENDOR_ID_CORSAIR, 0x1c05), .driver_data = (kernel_ulong_t)&clink_model_hxi }, /* HX750i */
+    { HID_USB_DEVICE(USB_VENDOR_ID_CORSAIR, 0x1c06), .driver_data = (kernel_ulong_t)&clink_model_hxi }, /* HX850i */
+    { HID_USB_DEVICE(USB_VENDOR_ID_CORSAIR, 0x1c07), .driver_data = (kernel_ulong_t)&clink_model_hxi }, /* HX1000i */
+    { HID_USB_DEVICE(USB_VENDOR_ID_CORSAIR, 0x1c08), .driver_data = (kernel_ulong_t)&clink_model_hxi }, /* HX1200i */
 	{ }
 };
 
@@ -550,6 +3585,14 @@ static struct hid_driver clink_driver = {
 	.probe = clink_probe,
 	.remove = clink_remove,
 	.raw_event = clink_raw_event,
+	.driver = {
+		.probe_type = PROBE_PREFER_ASYNCHRONOUS,
+	},
+#ifdef CONFIG_PM
+	.suspend = clink_suspend,
+	.resume = clink_resume,
+	.reset_resume = clink_resume,
+#endif
 };
 
 MODULE_DEVICE_TABLE(hid, clink_devices);
@@ -557,12 +3600,36 @@ MODULE_LICENSE("GPL");
 
 static int __init clink_init(void)
 {
-	return hid_register_driver(&clink_driver);
+	int ret;
+
+	clink_debugfs_root = debugfs_create_dir("corsairlink", NULL);
+
+	if (aggregate) {
+		ret = clink_total_register();
+		if (ret)
+			goto out_debugfs;
+	}
+
+	ret = hid_register_driver(&clink_driver);
+	if (ret)
+		goto out_total;
+
+	return 0;
+
+out_total:
+	if (aggregate)
+		clink_total_unregister();
+out_debugfs:
+	debugfs_remove_recursive(clink_debugfs_root);
+	return ret;
 }
 
 static void __exit clink_exit(void)
 {
 	hid_unregister_driver(&clink_driver);
+	if (aggregate)
+		clink_total_unregister();
+	debugfs_remove_recursive(clink_debugfs_root);
 }
 
 /*
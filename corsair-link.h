@@ -0,0 +1,46 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later WITH Linux-syscall-note */
+/*
+ * corsair-link.h - userspace interface of the corsair-link driver
+ *
+ * Every PSU bound to the driver gets a character device /dev/corsairlink<N> through which
+ * tools send raw register requests without going through hidraw. N counts from 0 in the order
+ * the PSUs are bound, numbers of unbound PSUs are reused. A batch of requests runs
+ * under the driver's device lock, so no sampler or sysfs request of the driver, and no other
+ * batch, is interleaved with it and no response is taken by the wrong reader.
+ */
+
+#ifndef _UAPI_CORSAIR_LINK_H
+#define _UAPI_CORSAIR_LINK_H
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+/* commands of struct clink_op, the values sent to the device */
+#define CLINK_OP_WRITE		0x02
+#define CLINK_OP_READ		0x03
+
+#define CLINK_OP_DATA_SIZE	62 /* payload of a 64 byte report after command and register */
+#define CLINK_MAX_OPS		64
+
+struct clink_op {
+	__u8 cmd;		/* CLINK_OP_READ or CLINK_OP_WRITE */
+	__u8 reg;
+	__u8 len;		/* in: bytes of data written, out: bytes of data returned */
+	__u8 flags;		/* must be 0 */
+	__s32 result;		/* out: 0 or a negative errno */
+	__u8 data[CLINK_OP_DATA_SIZE]; /* in: written value, out: response after cmd and reg */
+	__u8 reserved[2];	/* must be 0 */
+};
+
+struct clink_batch {
+	__u64 ops;		/* pointer to nr_ops struct clink_op */
+	__u32 nr_ops;		/* at most CLINK_MAX_OPS */
+	__u32 nr_done;		/* out: ops run, a batch stops at the first failed op */
+};
+
+#define CLINK_IOC_MAGIC		0xC1
+
+/* runs the ops of a batch in order, returns 0 when the batch was run even if an op failed */
+#define CLINK_IOC_BATCH		_IOWR(CLINK_IOC_MAGIC, 0x01, struct clink_batch)
+
+#endif /* _UAPI_CORSAIR_LINK_H */
@@ -0,0 +1,360 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * clink-bench.c - sysfs read latency and throughput benchmark for corsair-link
+ *
+ * Runs N reader threads over the hwmon attributes of one corsairlink device for a fixed time
+ * and reports throughput, latency percentiles and the USB transaction rate taken from the
+ * driver's debugfs stats. Meant to be run against real hardware or tools/clink-emu.
+ */
+
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <libgen.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define HWMON_CLASS	"/sys/class/hwmon"
+#define DEBUGFS_ROOT	"/sys/kernel/debug/corsairlink"
+#define MAX_ATTRS	64
+
+struct attr {
+	char path[PATH_MAX];
+};
+
+struct reader {
+	pthread_t thread;
+	unsigned int id;
+	uint64_t *lat_ns;
+	size_t nr, size;
+	unsigned long errors;
+};
+
+static struct attr attrs[MAX_ATTRS];
+static unsigned int nr_attrs;
+static volatile int running;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int read_line(const char *path, char *buf, size_t size)
+{
+	ssize_t len;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+
+	len = read(fd, buf, size - 1);
+	close(fd);
+	if (len < 0)
+		return -errno;
+
+	buf[len] = 0;
+	buf[strcspn(buf, "\n")] = 0;
+	return 0;
+}
+
+static int find_hwmon(char *dir, size_t size)
+{
+	char path[PATH_MAX], name[64];
+	struct dirent *de;
+	DIR *d;
+
+	d = opendir(HWMON_CLASS);
+	if (!d)
+		return -errno;
+
+	while ((de = readdir(d))) {
+		if (de->d_name[0] == '.')
+			continue;
+
+		snprintf(path, sizeof(path), HWMON_CLASS "/%s/name", de->d_name);
+		if (read_line(path, name, sizeof(name)) || strcmp(name, "corsairlink"))
+			continue;
+
+		snprintf(dir, size, HWMON_CLASS "/%s", de->d_name);
+		closedir(d);
+		return 0;
+	}
+
+	closedir(d);
+	return -ENODEV;
+}
+
+static int add_attr(const char *dir, const char *name)
+{
+	if (nr_attrs == MAX_ATTRS)
+		return -ENOSPC;
+
+	snprintf(attrs[nr_attrs++].path, PATH_MAX, "%s/%s", dir, name);
+	return 0;
+}
+
+static int find_attrs(const char *dir)
+{
+	struct dirent *de;
+	size_t len;
+	DIR *d;
+
+	d = opendir(dir);
+	if (!d)
+		return -errno;
+
+	while ((de = readdir(d))) {
+		len = strlen(de->d_name);
+		if (len > 6 && !strcmp(de->d_name + len - 6, "_input"))
+			add_attr(dir, de->d_name);
+	}
+
+	closedir(d);
+	return nr_attrs ? 0 : -ENOENT;
+}
+
+/* locates the driver's debugfs stats through the hid device the hwmon device hangs off */
+static void find_stats(const char *dir, char *stats, size_t size)
+{
+	char path[PATH_MAX], real[PATH_MAX];
+
+	snprintf(path, sizeof(path), "%s/device", dir);
+	if (!realpath(path, real)) {
+		stats[0] = 0;
+		return;
+	}
+
+	snprintf(stats, size, DEBUGFS_ROOT "/%s/stats", basename(real));
+}
+
+static long long read_stat(const char *stats, const char *key)
+{
+	char line[128];
+	size_t len = strlen(key);
+	long long val = -1;
+	FILE *f;
+
+	if (!stats[0])
+		return -1;
+
+	f = fopen(stats, "r");
+	if (!f)
+		return -1;
+
+	while (fgets(line, sizeof(line), f)) {
+		if (!strncmp(line, key, len) && line[len] == ' ') {
+			val = strtoll(line + len + 1, NULL, 10);
+			break;
+		}
+	}
+
+	fclose(f);
+	return val;
+}
+
+static void *reader_fn(void *arg)
+{
+	struct reader *r = arg;
+	unsigned int i;
+	char buf[64];
+	uint64_t start;
+	int fds[MAX_ATTRS];
+	ssize_t len;
+
+	for (i = 0; i < nr_attrs; i++)
+		fds[i] = open(attrs[i].path, O_RDONLY);
+
+	i = r->id % nr_attrs;
+	while (running) {
+		start = now_ns();
+		len = fds[i] < 0 ? -1 : pread(fds[i], buf, sizeof(buf), 0);
+		if (len < 0) {
+			r->errors++;
+		} else {
+			if (r->nr == r->size) {
+				r->size = r->size ? r->size * 2 : 4096;
+				r->lat_ns = realloc(r->lat_ns, r->size * sizeof(*r->lat_ns));
+				if (!r->lat_ns)
+					abort();
+			}
+			r->lat_ns[r->nr++] = now_ns() - start;
+		}
+
+		i = (i + 1) % nr_attrs;
+	}
+
+	for (i = 0; i < nr_attrs; i++)
+		if (fds[i] >= 0)
+			close(fds[i]);
+
+	return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double percentile_us(const uint64_t *lat, size_t nr, double p)
+{
+	size_t idx;
+
+	if (!nr)
+		return 0;
+
+	idx = (size_t)(p * (nr - 1) + 0.5);
+	return lat[idx] / 1000.0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"  -d DIR         hwmon directory (default: first device named corsairlink)\n"
+		"  -a ATTR        attribute to read, may be repeated (default: all *_input)\n"
+		"  -n THREADS     number of reader threads (default 4)\n"
+		"  -t SEC         duration (default 10)\n"
+		"  -s FILE        driver stats file (default: derived from the hwmon device)\n",
+		prog);
+}
+
+int main(int argc, char **argv)
+{
+	char dir[PATH_MAX] = "", stats[PATH_MAX] = "";
+	unsigned int nr_threads = 4, duration = 10, i;
+	struct reader *readers;
+	long long tx_start, tx_end, to_start, to_end;
+	uint64_t start, elapsed, *lat;
+	unsigned long errors = 0;
+	size_t nr = 0, pos = 0;
+	double seconds;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "d:a:n:t:s:h")) != -1) {
+		switch (opt) {
+		case 'd':
+			snprintf(dir, sizeof(dir), "%s", optarg);
+			break;
+		case 'a':
+			if (!dir[0] && find_hwmon(dir, sizeof(dir))) {
+				fprintf(stderr, "no corsairlink hwmon device found\n");
+				return 1;
+			}
+			add_attr(dir, optarg);
+			break;
+		case 'n':
+			nr_threads = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			duration = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			snprintf(stats, sizeof(stats), "%s", optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (!dir[0] && find_hwmon(dir, sizeof(dir))) {
+		fprintf(stderr, "no corsairlink hwmon device found\n");
+		return 1;
+	}
+
+	if (!nr_attrs && find_attrs(dir)) {
+		fprintf(stderr, "no attributes to read in %s\n", dir);
+		return 1;
+	}
+
+	if (!stats[0])
+		find_stats(dir, stats, sizeof(stats));
+
+	if (!nr_threads)
+		nr_threads = 1;
+
+	readers = calloc(nr_threads, sizeof(*readers));
+	if (!readers)
+		return 1;
+
+	tx_start = read_stat(stats, "transactions");
+	to_start = read_stat(stats, "timeouts");
+
+	running = 1;
+	start = now_ns();
+	for (i = 0; i < nr_threads; i++) {
+		readers[i].id = i;
+		if (pthread_create(&readers[i].thread, NULL, reader_fn, &readers[i])) {
+			fprintf(stderr, "cannot create reader thread\n");
+			return 1;
+		}
+	}
+
+	sleep(duration);
+	running = 0;
+
+	for (i = 0; i < nr_threads; i++) {
+		pthread_join(readers[i].thread, NULL);
+		nr += readers[i].nr;
+		errors += readers[i].errors;
+	}
+	elapsed = now_ns() - start;
+	seconds = elapsed / 1e9;
+
+	tx_end = read_stat(stats, "transactions");
+	to_end = read_stat(stats, "timeouts");
+
+	lat = malloc((nr ? nr : 1) * sizeof(*lat));
+	if (!lat)
+		return 1;
+	for (i = 0; i < nr_threads; i++) {
+		memcpy(lat + pos, readers[i].lat_ns, readers[i].nr * sizeof(*lat));
+		pos += readers[i].nr;
+		free(readers[i].lat_ns);
+	}
+	qsort(lat, nr, sizeof(*lat), cmp_u64);
+
+	printf("device        %s\n", dir);
+	printf("threads       %u\n", nr_threads);
+	printf("attributes    %u\n", nr_attrs);
+	printf("duration_s    %.3f\n", seconds);
+	printf("ops           %zu\n", nr);
+	printf("errors        %lu\n", errors);
+	printf("ops_per_s     %.1f\n", nr / seconds);
+	if (nr) {
+		printf("lat_min_us    %.1f\n", lat[0] / 1000.0);
+		printf("lat_p50_us    %.1f\n", percentile_us(lat, nr, 0.50));
+		printf("lat_p99_us    %.1f\n", percentile_us(lat, nr, 0.99));
+		printf("lat_p999_us   %.1f\n", percentile_us(lat, nr, 0.999));
+		printf("lat_max_us    %.1f\n", lat[nr - 1] / 1000.0);
+	}
+	if (tx_start >= 0 && tx_end >= 0) {
+		printf("usb_tx        %lld\n", tx_end - tx_start);
+		printf("usb_tx_per_s  %.1f\n", (tx_end - tx_start) / seconds);
+		if (nr)
+			printf("usb_tx_per_op %.2f\n", (double)(tx_end - tx_start) / nr);
+	} else {
+		printf("usb_tx        n/a (cannot read %s)\n", stats[0] ? stats : "driver stats");
+	}
+	if (to_start >= 0 && to_end >= 0)
+		printf("usb_timeouts  %lld\n", to_end - to_start);
+
+	free(lat);
+	free(readers);
+
+	return 0;
+}
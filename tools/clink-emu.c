@@ -0,0 +1,847 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * clink-emu.c - uhid based emulator of Corsair Link PSUs
+ *
+ * Creates a HID device through /dev/uhid with the VID/PID of one of the PSUs supported by
+ * corsair-link.c and answers its register protocol, so the driver binds to it unmodified.
+ * Response latency, jitter, drop rate and the waveform of every sensor are configurable,
+ * which allows benchmarking and regression testing of the driver on any Linux box or VM.
+ *
+ * With -R the responses are taken from a traffic capture made by the driver (debugfs
+ * corsairlink/<device>/trace) and delivered with the latency recorded in it.
+ *
+ * Needs write access to /dev/uhid (usually root).
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <math.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/uhid.h>
+
+/* keep in sync with corsair-link.c */
+#define USB_VENDOR_ID_CORSAIR   0x1b1c
+
+#define REPORT_SIZE		64
+
+#define CMD_WRITE_REGISTER  0x02
+#define CMD_READ_REGISTER   0x03
+
+#define REG_CHANNEL_SELECT 0x00
+#define REG_TEMP_0      0x8D
+#define REG_TEMP_1      0x8E
+#define REG_VOLTAGE_PS  0x88
+#define REG_VOLTAGE     0x8B
+#define REG_CURRENT     0x8C
+#define REG_FAN_RPM     0x90
+#define REG_POWER       0x96
+#define REG_POWER_PS    0xEE
+#define REG_DEVICE_NAME 0xFE
+#define REG_RAIL        0xD8
+#define REG_FAN_DUTY    0x3B
+#define REG_FAN_MODE    0xF0
+
+/* fan speed per percent of duty in software fan mode */
+#define FAN_RPM_PER_DUTY	20
+
+#define NR_RAILS	3
+#define MAX_PENDING	64
+
+/* traffic capture format of corsair-link.c */
+#define TRACE_MAGIC	"CLTR"
+#define TRACE_OUT	0
+#define TRACE_IN	1
+
+struct trace_header {
+	char magic[4];
+	uint16_t version;
+	uint16_t product;
+} __attribute__((__packed__));
+
+struct trace_record {
+	uint32_t delta_us;
+	uint8_t dir;
+	uint8_t len;
+} __attribute__((__packed__));
+
+struct model {
+	uint16_t pid;
+	const char *name;
+};
+
+static const struct model models[] = {
+	{ 0x1c09, "RM550i" },
+	{ 0x1c0a, "RM650i" },
+	{ 0x1c0b, "RM750i" },
+	{ 0x1c0c, "RM850i" },
+	{ 0x1c0d, "RM1000i" },
+	{ 0x1c03, "HX550i" },
+	{ 0x1c04, "HX650i" },
+	{ 0x1c05, "HX750i" },
+	{ 0x1c06, "HX850i" },
+	{ 0x1c07, "HX1000i" },
+	{ 0x1c08, "HX1200i" },
+};
+
+enum wave_shape {
+	WAVE_CONST,
+	WAVE_SINE,
+	WAVE_SQUARE,
+	WAVE_SAW,
+	WAVE_NOISE,
+};
+
+static const char * const wave_names[] = { "const", "sine", "square", "saw", "noise" };
+
+struct sensor {
+	const char *name;
+	uint8_t reg;
+	int rail;		/* -1 if the register does not depend on REG_CHANNEL_SELECT */
+	enum wave_shape shape;
+	double base;
+	double amplitude;
+	double period_ms;
+};
+
+static struct sensor sensors[] = {
+	{ "temp0",    REG_TEMP_0,     -1, WAVE_CONST,  42.0, 0, 1000 },
+	{ "temp1",    REG_TEMP_1,     -1, WAVE_CONST,  36.5, 0, 1000 },
+	{ "fan",      REG_FAN_RPM,    -1, WAVE_CONST, 620.0, 0, 1000 },
+	{ "in_ps",    REG_VOLTAGE_PS, -1, WAVE_CONST, 230.0, 0, 1000 },
+	{ "in_12",    REG_VOLTAGE,     0, WAVE_CONST,  12.1, 0, 1000 },
+	{ "in_5",     REG_VOLTAGE,     1, WAVE_CONST,   5.0, 0, 1000 },
+	{ "in_33",    REG_VOLTAGE,     2, WAVE_CONST,   3.3, 0, 1000 },
+	{ "curr_12",  REG_CURRENT,     0, WAVE_CONST,  20.0, 0, 1000 },
+	{ "curr_5",   REG_CURRENT,     1, WAVE_CONST,   2.0, 0, 1000 },
+	{ "curr_33",  REG_CURRENT,     2, WAVE_CONST,   1.5, 0, 1000 },
+	{ "power_ps", REG_POWER_PS,   -1, WAVE_CONST, 300.0, 0, 1000 },
+	{ "power_12", REG_POWER,       0, WAVE_CONST, 242.0, 0, 1000 },
+	{ "power_5",  REG_POWER,       1, WAVE_CONST,  10.0, 0, 1000 },
+	{ "power_33", REG_POWER,       2, WAVE_CONST,   5.0, 0, 1000 },
+};
+
+#define NR_SENSORS (sizeof(sensors) / sizeof(sensors[0]))
+
+struct response {
+	uint64_t due_ns;
+	uint8_t data[REPORT_SIZE];
+};
+
+struct replay_report {
+	uint64_t t_us;
+	uint8_t dir;
+	uint8_t len;
+	uint8_t data[REPORT_SIZE];
+};
+
+struct emu {
+	int fd;
+	const struct model *model;
+	uint32_t latency_us;
+	uint32_t jitter_us;
+	uint32_t control_us;
+	double drop_rate;
+	int verbose;
+
+	uint8_t channel;
+	uint8_t rail_mode;
+	uint8_t fan_mode;
+	uint8_t fan_duty;
+	uint64_t start_ns;
+
+	struct response pending[MAX_PENDING];
+	unsigned int head, count;
+
+	struct replay_report *replay;
+	size_t replay_nr, replay_pos;
+	uint16_t replay_product;
+
+	unsigned long requests, responses, dropped, overruns, unmatched;
+};
+
+/* vendor defined collection with one 64 byte input and one 64 byte output report, no report ids */
+static const uint8_t report_desc[] = {
+	0x06, 0x00, 0xff,	/* Usage Page (Vendor Defined 0xFF00) */
+	0x09, 0x01,		/* Usage (0x01) */
+	0xa1, 0x01,		/* Collection (Application) */
+	0x09, 0x02,		/*   Usage (0x02) */
+	0x15, 0x00,		/*   Logical Minimum (0) */
+	0x26, 0xff, 0x00,	/*   Logical Maximum (255) */
+	0x75, 0x08,		/*   Report Size (8) */
+	0x95, REPORT_SIZE,	/*   Report Count (64) */
+	0x81, 0x02,		/*   Input (Data,Var,Abs) */
+	0x09, 0x03,		/*   Usage (0x03) */
+	0x15, 0x00,		/*   Logical Minimum (0) */
+	0x26, 0xff, 0x00,	/*   Logical Maximum (255) */
+	0x75, 0x08,		/*   Report Size (8) */
+	0x95, REPORT_SIZE,	/*   Report Count (64) */
+	0x91, 0x02,		/*   Output (Data,Var,Abs) */
+	0xc0,			/* End Collection */
+};
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig)
+{
+	(void)sig;
+	stop = 1;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* encodes a value in the PMBus LINEAR11 format used by the device: 5 bit exponent, 11 bit mantissa */
+static uint16_t linear11_encode(double value)
+{
+	int exponent;
+
+	for (exponent = -16; exponent < 15; exponent++) {
+		double mantissa = value / ldexp(1.0, exponent);
+
+		if (mantissa >= -1024.0 && mantissa <= 1023.0)
+			break;
+	}
+
+	return ((exponent & 0x1f) << 11) | ((int)lround(value / ldexp(1.0, exponent)) & 0x7ff);
+}
+
+static double sensor_value(const struct sensor *s, uint64_t t_ns)
+{
+	double phase = fmod(t_ns / 1e6, s->period_ms) / s->period_ms;
+
+	switch (s->shape) {
+	case WAVE_SINE:
+		return s->base + s->amplitude * sin(2 * M_PI * phase);
+	case WAVE_SQUARE:
+		return s->base + (phase < 0.5 ? s->amplitude : -s->amplitude);
+	case WAVE_SAW:
+		return s->base + s->amplitude * (2 * phase - 1);
+	case WAVE_NOISE:
+		return s->base + s->amplitude * (2.0 * rand() / RAND_MAX - 1);
+	case WAVE_CONST:
+	default:
+		return s->base;
+	}
+}
+
+static const struct sensor *find_sensor(uint8_t reg, int channel)
+{
+	unsigned int i;
+
+	for (i = 0; i < NR_SENSORS; i++)
+		if (sensors[i].reg == reg && (sensors[i].rail < 0 || sensors[i].rail == channel))
+			return &sensors[i];
+
+	return NULL;
+}
+
+static int uhid_write(int fd, const struct uhid_event *ev)
+{
+	ssize_t ret = write(fd, ev, sizeof(*ev));
+
+	if (ret < 0)
+		return -errno;
+	if (ret != sizeof(*ev))
+		return -EFAULT;
+
+	return 0;
+}
+
+static int emu_create(struct emu *emu)
+{
+	struct uhid_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.type = UHID_CREATE2;
+	snprintf((char *)ev.u.create2.name, sizeof(ev.u.create2.name), "Corsair %s (emulated)",
+		 emu->model->name);
+	snprintf((char *)ev.u.create2.phys, sizeof(ev.u.create2.phys), "clink-emu/%d", getpid());
+	memcpy(ev.u.create2.rd_data, report_desc, sizeof(report_desc));
+	ev.u.create2.rd_size = sizeof(report_desc);
+	ev.u.create2.bus = BUS_USB;
+	ev.u.create2.vendor = USB_VENDOR_ID_CORSAIR;
+	ev.u.create2.product = emu->model->pid;
+
+	return uhid_write(emu->fd, &ev);
+}
+
+static void emu_destroy(struct emu *emu)
+{
+	struct uhid_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.type = UHID_DESTROY;
+	uhid_write(emu->fd, &ev);
+}
+
+/* builds the response to one output report; returns 0 if the device would not answer */
+static int emu_answer(struct emu *emu, const uint8_t *req, size_t size, uint8_t *resp)
+{
+	const struct sensor *s;
+	uint16_t value;
+
+	if (size < 2)
+		return 0;
+
+	memset(resp, 0, REPORT_SIZE);
+	resp[0] = req[0];
+	resp[1] = req[1];
+
+	switch (req[0]) {
+	case CMD_WRITE_REGISTER:
+		if (size < 3)
+			return 0;
+		if (req[1] == REG_CHANNEL_SELECT && req[2] < NR_RAILS)
+			emu->channel = req[2];
+		else if (req[1] == REG_RAIL && (req[2] == 1 || req[2] == 2))
+			emu->rail_mode = req[2];
+		else if (req[1] == REG_FAN_MODE && req[2] <= 1)
+			emu->fan_mode = req[2];
+		else if (req[1] == REG_FAN_DUTY && req[2] <= 100)
+			emu->fan_duty = req[2];
+		resp[2] = req[2];
+		return 1;
+	case CMD_READ_REGISTER:
+		switch (req[1]) {
+		case REG_CHANNEL_SELECT:
+			resp[2] = emu->channel;
+			return 1;
+		case REG_RAIL:
+			resp[2] = emu->rail_mode;
+			return 1;
+		case REG_FAN_MODE:
+			resp[2] = emu->fan_mode;
+			return 1;
+		case REG_FAN_DUTY:
+			resp[2] = emu->fan_duty;
+			return 1;
+		case REG_DEVICE_NAME:
+			strncpy((char *)resp + 2, emu->model->name, REPORT_SIZE - 3);
+			return 1;
+		case REG_FAN_RPM:
+			/* in software mode the fan follows the duty set by the driver */
+			if (emu->fan_mode) {
+				value = linear11_encode(emu->fan_duty * FAN_RPM_PER_DUTY);
+				resp[2] = value & 0xff;
+				resp[3] = value >> 8;
+				return 1;
+			}
+			break;
+		}
+
+		s = find_sensor(req[1], emu->channel);
+		if (s) {
+			value = linear11_encode(sensor_value(s, now_ns() - emu->start_ns));
+			resp[2] = value & 0xff;
+			resp[3] = value >> 8;
+		}
+		return 1;
+	default:
+		return 1;
+	}
+}
+
+/* loads a capture; x86/arm little endian hosts only, like the format itself */
+static int replay_load(struct emu *emu, const char *path)
+{
+	struct trace_record rec;
+	struct replay_report *rep;
+	uint64_t t_us = 0;
+	uint8_t *buf;
+	size_t len, pos = 0, alloc = 0;
+	long size;
+	FILE *f;
+
+	f = fopen(path, "rb");
+	if (!f)
+		return -errno;
+
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	rewind(f);
+	if (size < (long)sizeof(struct trace_header)) {
+		fclose(f);
+		return -EINVAL;
+	}
+
+	buf = malloc(size);
+	if (!buf) {
+		fclose(f);
+		return -ENOMEM;
+	}
+	len = fread(buf, 1, size, f);
+	fclose(f);
+
+	while (pos + sizeof(rec) <= len) {
+		/* captures may be concatenations of several reads, each starting with a header */
+		if (!memcmp(buf + pos, TRACE_MAGIC, 4) && pos + sizeof(struct trace_header) <= len) {
+			emu->replay_product = ((struct trace_header *)(buf + pos))->product;
+			pos += sizeof(struct trace_header);
+			continue;
+		}
+
+		memcpy(&rec, buf + pos, sizeof(rec));
+		pos += sizeof(rec);
+		if (rec.len > REPORT_SIZE || pos + rec.len > len)
+			break;
+
+		if (emu->replay_nr == alloc) {
+			alloc = alloc ? alloc * 2 : 1024;
+			emu->replay = realloc(emu->replay, alloc * sizeof(*emu->replay));
+			if (!emu->replay) {
+				free(buf);
+				return -ENOMEM;
+			}
+		}
+
+		t_us += rec.delta_us;
+		rep = &emu->replay[emu->replay_nr++];
+		memset(rep, 0, sizeof(*rep));
+		rep->t_us = t_us;
+		rep->dir = rec.dir;
+		rep->len = rec.len;
+		memcpy(rep->data, buf + pos, rec.len);
+		pos += rec.len;
+	}
+
+	free(buf);
+
+	return emu->replay_nr ? 0 : -EINVAL;
+}
+
+static int replay_match(const struct replay_report *rep, const uint8_t *req, size_t size)
+{
+	/* trailing zeros are stripped in the capture, but the argument of a write is significant */
+	size_t len = req[0] == CMD_WRITE_REGISTER ? 3 : 2;
+
+	if (rep->dir != TRACE_OUT)
+		return 0;
+	if (rep->len > len)
+		len = rep->len;
+	if (len > size)
+		return 0;
+
+	return !memcmp(rep->data, req, len);
+}
+
+/*
+ * Looks up the request in the capture, continuing where the previous lookup stopped.
+ * Returns 1 and the recorded response and latency if the device answered, 0 if it did not
+ * and -1 if the request does not appear in the capture.
+ */
+static int replay_answer(struct emu *emu, const uint8_t *req, size_t size, uint8_t *resp,
+			 uint64_t *delay_us)
+{
+	const struct replay_report *out, *in;
+	size_t i, j;
+
+	for (i = 0; i < emu->replay_nr; i++) {
+		j = (emu->replay_pos + i) % emu->replay_nr;
+		out = &emu->replay[j];
+		if (!replay_match(out, req, size))
+			continue;
+
+		if (j + 1 == emu->replay_nr || emu->replay[j + 1].dir != TRACE_IN) {
+			emu->replay_pos = j + 1;
+			return 0;
+		}
+
+		in = &emu->replay[j + 1];
+		memset(resp, 0, REPORT_SIZE);
+		memcpy(resp, in->data, in->len);
+		*delay_us = in->t_us - out->t_us;
+		emu->replay_pos = j + 2;
+		return 1;
+	}
+
+	return -1;
+}
+
+/* extra_us is added to the latency of this request */
+static void emu_queue(struct emu *emu, const uint8_t *req, size_t size, uint32_t extra_us)
+{
+	struct response *r, *prev;
+	uint64_t delay_us = emu->latency_us;
+	int ret;
+
+	emu->requests++;
+
+	if (emu->verbose)
+		fprintf(stderr, "req  %02x %02x %02x\n", req[0], size > 1 ? req[1] : 0,
+			size > 2 ? req[2] : 0);
+
+	if (emu->drop_rate > 0 && (double)rand() / RAND_MAX < emu->drop_rate) {
+		emu->dropped++;
+		return;
+	}
+
+	if (emu->count == MAX_PENDING) {
+		emu->overruns++;
+		return;
+	}
+
+	r = &emu->pending[(emu->head + emu->count) % MAX_PENDING];
+	if (!emu_answer(emu, req, size, r->data))
+		return;
+
+	if (emu->replay_nr) {
+		ret = replay_answer(emu, req, size, r->data, &delay_us);
+		if (ret == 0) {
+			emu->dropped++;
+			return;
+		}
+		if (ret < 0)
+			emu->unmatched++;
+	}
+
+	delay_us += extra_us;
+	if (emu->jitter_us)
+		delay_us += rand() % (emu->jitter_us + 1);
+	r->due_ns = now_ns() + delay_us * 1000;
+
+	/* the interrupt endpoint delivers reports in order, whatever the jitter */
+	if (emu->count) {
+		prev = &emu->pending[(emu->head + emu->count - 1) % MAX_PENDING];
+		if (r->due_ns < prev->due_ns)
+			r->due_ns = prev->due_ns;
+	}
+
+	emu->count++;
+}
+
+static int emu_flush(struct emu *emu)
+{
+	struct uhid_event ev;
+	struct response *r;
+	uint64_t now = now_ns();
+	int ret;
+
+	while (emu->count) {
+		r = &emu->pending[emu->head];
+		if (r->due_ns > now)
+			break;
+
+		memset(&ev, 0, sizeof(ev));
+		ev.type = UHID_INPUT2;
+		ev.u.input2.size = REPORT_SIZE;
+		memcpy(ev.u.input2.data, r->data, REPORT_SIZE);
+
+		ret = uhid_write(emu->fd, &ev);
+		if (ret)
+			return ret;
+
+		if (emu->verbose)
+			fprintf(stderr, "resp %02x %02x %02x %02x\n", r->data[0], r->data[1],
+				r->data[2], r->data[3]);
+
+		emu->head = (emu->head + 1) % MAX_PENDING;
+		emu->count--;
+		emu->responses++;
+	}
+
+	return 0;
+}
+
+static int emu_event(struct emu *emu)
+{
+	struct uhid_event ev;
+	uint32_t id;
+	ssize_t ret;
+
+	ret = read(emu->fd, &ev, sizeof(ev));
+	if (ret < 0)
+		return errno == EINTR || errno == EAGAIN ? 0 : -errno;
+
+	switch (ev.type) {
+	case UHID_START:
+		if (emu->verbose)
+			fprintf(stderr, "start\n");
+		break;
+	case UHID_OPEN:
+		if (emu->verbose)
+			fprintf(stderr, "open\n");
+		break;
+	case UHID_CLOSE:
+		if (emu->verbose)
+			fprintf(stderr, "close\n");
+		break;
+	case UHID_STOP:
+		if (emu->verbose)
+			fprintf(stderr, "stop\n");
+		break;
+	case UHID_OUTPUT:
+		if (ev.u.output.rtype == UHID_OUTPUT_REPORT)
+			emu_queue(emu, ev.u.output.data, ev.u.output.size, 0);
+		break;
+	case UHID_SET_REPORT:
+		/* a request sent over the control pipe, the data starts with report id 0 */
+		if (ev.u.set_report.rtype == UHID_OUTPUT_REPORT) {
+			if (ev.u.set_report.rnum == 0 && ev.u.set_report.size > 0)
+				emu_queue(emu, ev.u.set_report.data + 1, ev.u.set_report.size - 1,
+					  emu->control_us);
+			else
+				emu_queue(emu, ev.u.set_report.data, ev.u.set_report.size,
+					  emu->control_us);
+		}
+		id = ev.u.set_report.id;
+		memset(&ev.u.set_report_reply, 0, sizeof(ev.u.set_report_reply));
+		ev.type = UHID_SET_REPORT_REPLY;
+		ev.u.set_report_reply.id = id;
+		return uhid_write(emu->fd, &ev);
+	case UHID_GET_REPORT:
+		/* the reply is matched by id, the kernel drops one it does not wait for */
+		id = ev.u.get_report.id;
+		memset(&ev.u.get_report_reply, 0, sizeof(ev.u.get_report_reply));
+		ev.type = UHID_GET_REPORT_REPLY;
+		ev.u.get_report_reply.id = id;
+		ev.u.get_report_reply.err = EIO;
+		return uhid_write(emu->fd, &ev);
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+static int parse_wave(const char *arg)
+{
+	char name[16], shape[16];
+	double base, amplitude = 0, period = 1000;
+	unsigned int i, j;
+	int n;
+
+	n = sscanf(arg, "%15[^=]=%15[^:]:%lf:%lf:%lf", name, shape, &base, &amplitude, &period);
+	if (n < 3 || period <= 0)
+		return -EINVAL;
+
+	for (i = 0; i < NR_SENSORS; i++) {
+		if (strcmp(sensors[i].name, name))
+			continue;
+
+		for (j = 0; j < sizeof(wave_names) / sizeof(wave_names[0]); j++) {
+			if (!strcmp(wave_names[j], shape)) {
+				sensors[i].shape = j;
+				sensors[i].base = base;
+				sensors[i].amplitude = amplitude;
+				sensors[i].period_ms = period;
+				return 0;
+			}
+		}
+		return -EINVAL;
+	}
+
+	return -EINVAL;
+}
+
+static const struct model *find_model_pid(unsigned long pid)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(models) / sizeof(models[0]); i++)
+		if (models[i].pid == pid)
+			return &models[i];
+
+	return NULL;
+}
+
+static const struct model *find_model(const char *arg)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(models) / sizeof(models[0]); i++)
+		if (!strcasecmp(models[i].name, arg))
+			return &models[i];
+
+	return find_model_pid(strtoul(arg, NULL, 16));
+}
+
+static void usage(const char *prog)
+{
+	unsigned int i;
+
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"  -m MODEL       model name or USB PID (default RM650i)\n"
+		"  -l USEC        response latency (default 2000)\n"
+		"  -j USEC        additional uniformly distributed jitter (default 0)\n"
+		"  -c USEC        additional latency of requests sent over the control pipe (default 0)\n"
+		"  -d RATE        fraction of requests left unanswered, 0..1 (default 0)\n"
+		"  -s SENSOR=SHAPE:BASE[:AMPLITUDE[:PERIOD_MS]]\n"
+		"                 sensor waveform, may be repeated\n"
+		"  -t SEC         exit after SEC seconds (default: run until interrupted)\n"
+		"  -r SEED        random seed\n"
+		"  -R FILE        replay responses and their latency from a driver capture\n"
+		"  -v             log every report\n"
+		"Sensors:", prog);
+	for (i = 0; i < NR_SENSORS; i++)
+		fprintf(stderr, " %s", sensors[i].name);
+	fprintf(stderr, "\nShapes:");
+	for (i = 0; i < sizeof(wave_names) / sizeof(wave_names[0]); i++)
+		fprintf(stderr, " %s", wave_names[i]);
+	fprintf(stderr, "\n");
+}
+
+int main(int argc, char **argv)
+{
+	struct emu emu = {
+		.model = &models[1],
+		.latency_us = 2000,
+		.rail_mode = 1,
+		.fan_duty = 100,
+	};
+	struct pollfd pfd;
+	struct timespec ts;
+	uint64_t deadline = 0, now, wake;
+	const char *replay = NULL;
+	int model_set = 0, opt, ret;
+
+	srand(time(NULL));
+
+	while ((opt = getopt(argc, argv, "m:l:j:c:d:s:t:r:R:vh")) != -1) {
+		switch (opt) {
+		case 'm':
+			emu.model = find_model(optarg);
+			if (!emu.model) {
+				fprintf(stderr, "unknown model %s\n", optarg);
+				return 1;
+			}
+			model_set = 1;
+			break;
+		case 'l':
+			emu.latency_us = strtoul(optarg, NULL, 0);
+			break;
+		case 'j':
+			emu.jitter_us = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			emu.control_us = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			emu.drop_rate = strtod(optarg, NULL);
+			break;
+		case 's':
+			if (parse_wave(optarg)) {
+				fprintf(stderr, "invalid sensor waveform %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 't':
+			deadline = strtoull(optarg, NULL, 0) * 1000000000ull;
+			break;
+		case 'r':
+			srand(strtoul(optarg, NULL, 0));
+			break;
+		case 'R':
+			replay = optarg;
+			break;
+		case 'v':
+			emu.verbose = 1;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (replay) {
+		ret = replay_load(&emu, replay);
+		if (ret) {
+			fprintf(stderr, "cannot load capture %s: %s\n", replay, strerror(-ret));
+			return 1;
+		}
+		if (!model_set && find_model_pid(emu.replay_product))
+			emu.model = find_model_pid(emu.replay_product);
+		else if (!model_set)
+			fprintf(stderr, "unknown product %04x in capture, emulating %s\n",
+				emu.replay_product, emu.model->name);
+		fprintf(stderr, "replaying %zu reports\n", emu.replay_nr);
+	}
+
+	emu.fd = open("/dev/uhid", O_RDWR | O_CLOEXEC);
+	if (emu.fd < 0) {
+		perror("/dev/uhid");
+		return 1;
+	}
+
+	ret = emu_create(&emu);
+	if (ret) {
+		fprintf(stderr, "cannot create uhid device: %s\n", strerror(-ret));
+		return 1;
+	}
+
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+
+	emu.start_ns = now_ns();
+	if (deadline)
+		deadline += emu.start_ns;
+
+	fprintf(stderr, "emulating %s (%04x:%04x)\n", emu.model->name, USB_VENDOR_ID_CORSAIR,
+		emu.model->pid);
+
+	pfd.fd = emu.fd;
+	pfd.events = POLLIN;
+
+	while (!stop) {
+		now = now_ns();
+		if (deadline && now >= deadline)
+			break;
+
+		wake = deadline;
+		if (emu.count && (!wake || emu.pending[emu.head].due_ns < wake))
+			wake = emu.pending[emu.head].due_ns;
+		if (wake) {
+			wake = wake > now ? wake - now : 0;
+			ts.tv_sec = wake / 1000000000ull;
+			ts.tv_nsec = wake % 1000000000ull;
+			ret = ppoll(&pfd, 1, &ts, NULL);
+		} else {
+			ret = ppoll(&pfd, 1, NULL, NULL);
+		}
+		if (ret < 0 && errno != EINTR) {
+			perror("ppoll");
+			break;
+		}
+
+		if (ret > 0 && (pfd.revents & POLLIN)) {
+			ret = emu_event(&emu);
+			if (ret) {
+				fprintf(stderr, "uhid: %s\n", strerror(-ret));
+				break;
+			}
+		}
+
+		ret = emu_flush(&emu);
+		if (ret) {
+			fprintf(stderr, "uhid: %s\n", strerror(-ret));
+			break;
+		}
+	}
+
+	emu_destroy(&emu);
+	close(emu.fd);
+
+	fprintf(stderr, "requests %lu responses %lu dropped %lu overruns %lu\n",
+		emu.requests, emu.responses, emu.dropped, emu.overruns);
+	if (emu.replay_nr)
+		fprintf(stderr, "requests not found in capture %lu\n", emu.unmatched);
+
+	free(emu.replay);
+
+	return 0;
+}
@@ -0,0 +1,134 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * clink-regs.c - raw register access to a corsair-link PSU through the driver
+ *
+ * Sends all registers given on the command line as one batch through the driver's character
+ * device, so the requests are serialised with the driver's own traffic instead of racing it
+ * for responses like a hidraw tool does. REG reads a register, REG=VALUE writes one byte.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include "../corsair-link.h"
+
+static int parse_op(const char *arg, struct clink_op *op)
+{
+	unsigned long reg, val;
+	char *end;
+
+	memset(op, 0, sizeof(*op));
+
+	reg = strtoul(arg, &end, 0);
+	if (end == arg || reg > 0xff)
+		return -EINVAL;
+	op->reg = reg;
+
+	if (!*end) {
+		op->cmd = CLINK_OP_READ;
+		return 0;
+	}
+	if (*end != '=')
+		return -EINVAL;
+
+	arg = end + 1;
+	val = strtoul(arg, &end, 0);
+	if (end == arg || *end || val > 0xff)
+		return -EINVAL;
+
+	op->cmd = CLINK_OP_WRITE;
+	op->len = 1;
+	op->data[0] = val;
+
+	return 0;
+}
+
+static void print_op(const struct clink_op *op, int raw)
+{
+	unsigned int i, len = raw ? op->len : 2;
+
+	printf("%s 0x%02x:", op->cmd == CLINK_OP_WRITE ? "write" : "read ", op->reg);
+	if (op->result) {
+		printf(" %s\n", strerror(-op->result));
+		return;
+	}
+
+	for (i = 0; i < len && i < CLINK_OP_DATA_SIZE; i++)
+		printf(" %02x", op->data[i]);
+	printf("\n");
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [options] REG[=VALUE]...\n"
+		"  -d DEVICE      character device (default /dev/corsairlink0, the first PSU bound)\n"
+		"  -r             print the whole response payload, not its first two bytes\n",
+		prog);
+}
+
+int main(int argc, char **argv)
+{
+	struct clink_op ops[CLINK_MAX_OPS];
+	struct clink_batch batch;
+	const char *dev = "/dev/corsairlink0";
+	int raw = 0, fd, opt, i, nr;
+
+	while ((opt = getopt(argc, argv, "d:rh")) != -1) {
+		switch (opt) {
+		case 'd':
+			dev = optarg;
+			break;
+		case 'r':
+			raw = 1;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	nr = argc - optind;
+	if (nr <= 0 || nr > CLINK_MAX_OPS) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	for (i = 0; i < nr; i++) {
+		if (parse_op(argv[optind + i], &ops[i])) {
+			fprintf(stderr, "invalid register %s\n", argv[optind + i]);
+			return 1;
+		}
+	}
+
+	fd = open(dev, O_RDWR | O_CLOEXEC);
+	if (fd < 0) {
+		perror(dev);
+		return 1;
+	}
+
+	memset(&batch, 0, sizeof(batch));
+	batch.ops = (uintptr_t)ops;
+	batch.nr_ops = nr;
+	if (ioctl(fd, CLINK_IOC_BATCH, &batch)) {
+		perror("CLINK_IOC_BATCH");
+		close(fd);
+		return 1;
+	}
+	close(fd);
+
+	for (i = 0; i < (int)batch.nr_done; i++)
+		print_op(&ops[i], raw);
+	for (; i < nr; i++)
+		printf("%s 0x%02x: not run\n", ops[i].cmd == CLINK_OP_WRITE ? "write" : "read ",
+		       ops[i].reg);
+
+	return batch.nr_done == (unsigned int)nr && !ops[nr - 1].result ? 0 : 1;
+}